@@ -1,6 +1,6 @@
-
 import { hex, byte2signed } from "./util";
 import { Platform } from "./baseplatform";
+import { disassembleZ80 } from "./cpu/disasmz80";
 
 export interface CodeAnalyzer {
   showLoopTimingForPC(pc:number);
@@ -9,202 +9,379 @@ export interface CodeAnalyzer {
   MAX_CLOCKS : number;
 }
 
-/// VCS TIMING ANALYSIS
-
-// [taken, not taken]
-const BRANCH_CONSTRAINTS = [
-  [{N:0},{N:1}],
-  [{N:1},{N:0}],
-  [{V:0},{V:1}],
-  [{V:1},{V:0}],
-  [{C:0},{C:1}],
-  [{C:1},{C:0}],
-  [{Z:0},{Z:1}],
-  [{Z:1},{Z:0}]
-];
+/// TIMING ANALYSIS
 
-function constraintEquals(a,b) {
-  if (a == null || b == null)
-    return null;
-  for (var n in a) {
-    if (b[n] !== 'undefined')
-      return a[n] == b[n];
-  }
-  for (var n in b) {
-    if (a[n] !== 'undefined')
-      return a[n] == b[n];
-  }
-  return null;
+// how control leaves an instruction
+enum Flow {
+  Next,         // falls through
+  Jump,         // always goes to target
+  Branch,       // target (maxCycles) or falls through (minCycles)
+  Call,         // subroutine at target, then falls through on return
+  CondCall,     // like Call (maxCycles) or falls through (minCycles)
+  Return,       // back to caller
+  CondReturn,   // back to caller (maxCycles) or falls through (minCycles)
+  Stop,         // can't follow (RTI, HALT, illegal, unknown indirect jump)
+}
+
+interface AnalyzedInsn {
+  pc : number;
+  len : number;
+  minCycles : number;
+  maxCycles : number;
+  flow : Flow;
+  target? : number;
+  cons? : number;       // flag known when branch is taken (flag*2+value), not taken is cons^1
+  clocks? : number[];   // [min,max] clocks after this instruction, instead of adding cycles
+  indirect? : boolean;  // target was read from memory, so don't cache
+  bytes? : number[];    // to check if the ROM changed under us
+}
+
+interface BasicBlock {
+  start : number;
+  insns : AnalyzedInsn[];
 }
 
-abstract class CodeAnalyzer6502 implements CodeAnalyzer {
+// clocks on entry to a block, for a given subroutine context
+interface ClockState {
+  min : number;
+  max : number;
+  cons : number;        // flag constraint, -1 if none
+}
+
+interface AnalysisCache {
+  insns : {[pc:number]:AnalyzedInsn};
+  hash : number;
+  pc2minclocks : {[key:number]:number};
+  pc2maxclocks : {[key:number]:number};
+}
+
+const MAX_BLOCK_INSNS = 256;
+const NO_SUBROUTINE = 0x10000;
+
+// decoded instructions and last results, per analyzer type, reused across rebuilds
+var analysisCaches : {[name:string]:AnalysisCache} = {};
+
+// worklist dataflow over basic blocks: each block gets the min/max clocks
+// on entry, and subroutines get a summary of their clocks on return
+export abstract class CodeAnalyzerBase implements CodeAnalyzer {
   pc2minclocks = {};
   pc2maxclocks = {};
   START_CLOCKS : number;
   MAX_CLOCKS : number;
   WRAP_CLOCKS : boolean;
-  jsrresult = {};
   platform : Platform;
-  MAX_CYCLES : number = 2000;
-  
+  cache : AnalysisCache;
+  checked : {[pc:number]:AnalyzedInsn};  // instructions validated this run
+  leaders : {[pc:number]:boolean};       // where blocks start
+  blocks : {[pc:number]:BasicBlock};
+  // dataflow state, keyed by subroutine*0x10000+pc
+  states : Map<number,ClockState>;
+  worklist : number[];
+  returns : {[sub:number]:ClockState};
+  callers : {[sub:number]:number[]};   // keys to resume after the subroutine
+
   constructor(platform : Platform) {
     this.platform = platform;
   }
 
-  getClockCountsAtPC(pc) {
-    var opcode = this.platform.readAddress(pc);
-    var meta = this.platform.getOpcodeMetadata(opcode, pc);
-    return meta; // minCycles, maxCycles
-  }
-
-  traceInstructions(pc:number, minclocks:number, maxclocks:number, subaddr:number, constraints) {
-    if (this.WRAP_CLOCKS) {
-      if (this.pc2minclocks[pc] !== undefined)
-        minclocks = Math.min(minclocks, this.pc2minclocks[pc]);
-      if (this.pc2maxclocks[pc] !== undefined)
-        maxclocks = Math.max(maxclocks, this.pc2maxclocks[pc]);
-    }
-    //console.log("trace", hex(pc), minclocks, maxclocks);
-    if (!constraints) constraints = {};
-    var modified = true;
-    var abort = false;
-    for (var i=0; modified && !abort; i++) {
-      if (i >= this.MAX_CYCLES) {
-        console.log("too many cycles @", hex(pc), "routine", hex(subaddr));
-        break;
-      }
-      modified = false;
-      if (this.WRAP_CLOCKS && minclocks >= this.MAX_CLOCKS) {
-        // wrap clocks
-        minclocks = minclocks % this.MAX_CLOCKS;
-        maxclocks = maxclocks % this.MAX_CLOCKS;
-      } else {
-        // truncate clocks
-        minclocks = Math.min(this.MAX_CLOCKS, minclocks);
-        maxclocks = Math.min(this.MAX_CLOCKS, maxclocks);
+  abstract getCacheName() : string;
+  abstract decodeInsn(pc : number) : AnalyzedInsn;
+
+  getEntryPC(pc : number) : number {
+    return pc;
+  }
+
+  showLoopTimingForPC(pc:number) {
+    var name = this.getCacheName();
+    this.cache = analysisCaches[name];
+    if (!this.cache) {
+      this.cache = analysisCaches[name] = {insns:{}, hash:null, pc2minclocks:null, pc2maxclocks:null};
+    }
+    this.checked = {};
+    this.leaders = {};
+    this.blocks = {};
+    var entry = this.getEntryPC(pc);
+    var hash = this.buildCFG(entry);
+    if (hash === this.cache.hash) {
+      this.pc2minclocks = this.cache.pc2minclocks;
+      this.pc2maxclocks = this.cache.pc2maxclocks;
+      return;
+    }
+    this.pc2minclocks = {};
+    this.pc2maxclocks = {};
+    this.runDataflow(entry);
+    this.cache.hash = hash;
+    this.cache.pc2minclocks = this.pc2minclocks;
+    this.cache.pc2maxclocks = this.pc2maxclocks;
+  }
+
+  // returns cached instruction if its bytes are unchanged, otherwise decodes it again
+  getInsn(pc : number) : AnalyzedInsn {
+    var insn = this.checked[pc];
+    if (insn) return insn;
+    insn = this.cache.insns[pc];
+    if (insn && insn.indirect) {
+      insn = null;
+    } else if (insn) {
+      for (var i=0; i<insn.bytes.length; i++) {
+        if (this.platform.readAddress((pc + i) & 0xffff) != insn.bytes[i]) {
+          insn = null;
+          break;
+        }
       }
-      var meta = this.getClockCountsAtPC(pc);
-      var lob = this.platform.readAddress(pc+1);
-      var hib = this.platform.readAddress(pc+2);
-      var addr = lob + (hib << 8);
-      var pc0 = pc;
-      if (!(minclocks >= this.pc2minclocks[pc0])) {
-        this.pc2minclocks[pc0] = minclocks;
-        modified = true;
+    }
+    if (!insn) {
+      insn = this.decodeInsn(pc);
+      insn.bytes = [];
+      for (var i=0; i<insn.len; i++)
+        insn.bytes.push(this.platform.readAddress((pc + i) & 0xffff));
+      this.cache.insns[pc] = insn;
+    }
+    return this.checked[pc] = insn;
+  }
+
+  // instructions from a leader up to the next control transfer or leader
+  getBlock(start : number) : BasicBlock {
+    var blk = this.blocks[start];
+    if (!blk) {
+      var insns = [];
+      var pc = start;
+      do {
+        var insn = this.getInsn(pc);
+        insns.push(insn);
+        pc = (pc + insn.len) & 0xffff;
+      } while (insn.flow == Flow.Next && !this.leaders[pc] && insns.length < MAX_BLOCK_INSNS);
+      blk = this.blocks[start] = {start:start, insns:insns};
+    }
+    return blk;
+  }
+
+  // visit every reachable instruction, finding leaders and hashing their contents
+  buildCFG(entry : number) : number {
+    var hash = 0x811c9dc5 ^ entry;
+    var visited = {};
+    var stack = [entry];
+    this.leaders[entry] = true;
+    while (stack.length) {
+      var pc = stack.pop();
+      if (visited[pc]) continue;
+      visited[pc] = true;
+      var insn = this.getInsn(pc);
+      hash = Math.imul(hash ^ pc, 0x01000193) >>> 0;
+      for (var b of insn.bytes)
+        hash = Math.imul(hash ^ b, 0x01000193) >>> 0;
+      var next = (pc + insn.len) & 0xffff;
+      if (insn.flow == Flow.Next) {
+        stack.push(next);
+        continue;
       }
-      if (!(maxclocks <= this.pc2maxclocks[pc0])) {
-        this.pc2maxclocks[pc0] = maxclocks;
-        modified = true;
+      if (insn.target != null) {
+        hash = Math.imul(hash ^ insn.target, 0x01000193) >>> 0;
+        this.leaders[insn.target] = true;
+        stack.push(insn.target);
       }
-      //console.log(hex(pc),minclocks,maxclocks,modified,meta,constraints);
-      if (!meta.insnlength) {
-        console.log("Illegal instruction!", hex(pc), hex(meta.opcode), meta);
-        break;
+      if (insn.flow != Flow.Jump && insn.flow != Flow.Return && insn.flow != Flow.Stop) {
+        this.leaders[next] = true;
+        stack.push(next);
       }
-      pc += meta.insnlength;
-      var oldconstraints = constraints;
-      constraints = null;
-      // TODO: if jump to zero-page, maybe assume RTS?
-      switch (meta.opcode) {
-        case 0x19: case 0x1d:
-        case 0x39: case 0x3d:
-        case 0x59: case 0x5d:
-        case 0x79: case 0x7d:
-        case 0x99: case 0x9d:
-        case 0xa9: case 0xad:
-        case 0xb9: case 0xbd: case 0xbc: case 0xbe:
-        case 0xd9: case 0xdd:
-        case 0xf9: case 0xfd:
-          if (lob == 0)
-            meta.maxCycles -= 1; // no page boundary crossed
-          break;
-        // TODO: only VCS
-        case 0x85:
-          if (lob == 0x2) { // STA WSYNC
-            minclocks = maxclocks = 0;
-            meta.minCycles = meta.maxCycles = 0;
-          }
-          break;
-        // TODO: only NES (sprite 0 poll)
-        case 0x2c:
-          if (lob == 0x02 && hib == 0x20) { // BIT $2002
-            minclocks = 0;
-            maxclocks = 4; // uncertainty b/c of assumed branch poll
-            meta.minCycles = meta.maxCycles = 0;
-          }
-          break;
-        case 0x20: // JSR
-          this.traceInstructions(addr, minclocks, maxclocks, addr, constraints);
-          var result = this.jsrresult[addr];
-          if (result) {
-            minclocks = result.minclocks;
-            maxclocks = result.maxclocks;
+    }
+    return hash;
+  }
+
+  // wrap or truncate clocks, so the lattice is finite
+  normalize(s : ClockState) {
+    if (this.WRAP_CLOCKS && s.min >= this.MAX_CLOCKS) {
+      var span = s.max - s.min;
+      s.min = s.min % this.MAX_CLOCKS;
+      s.max = Math.min(this.MAX_CLOCKS, s.min + span);
+    } else {
+      s.min = Math.min(this.MAX_CLOCKS, s.min);
+      s.max = Math.min(this.MAX_CLOCKS, s.max);
+    }
+  }
+
+  // join clocks into a block's entry state, queueing it if they changed
+  propagate(sub : number, pc : number, min : number, max : number, cons : number) {
+    var s = {min:min, max:max, cons:cons};
+    this.normalize(s);
+    var key = sub * 0x10000 + (pc & 0xffff);
+    var old = this.states.get(key);
+    if (old) {
+      if (s.min >= old.min && s.max <= old.max && (old.cons == -1 || old.cons == s.cons))
+        return;
+      s.min = Math.min(s.min, old.min);
+      s.max = Math.max(s.max, old.max);
+      if (old.cons != s.cons) s.cons = -1;
+    }
+    this.states.set(key, s);
+    this.worklist.push(key);
+  }
+
+  // join clocks at a return, resuming the callers if they changed
+  propagateReturn(sub : number, min : number, max : number) {
+    if (sub == NO_SUBROUTINE) return;
+    var s = {min:min, max:max, cons:-1};
+    this.normalize(s);
+    var old = this.returns[sub];
+    if (old) {
+      if (s.min >= old.min && s.max <= old.max)
+        return;
+      s.min = Math.min(s.min, old.min);
+      s.max = Math.max(s.max, old.max);
+    }
+    this.returns[sub] = s;
+    for (var key of this.callers[sub] || [])
+      this.propagate(Math.floor(key / 0x10000), key & 0xffff, s.min, s.max, -1);
+  }
+
+  runDataflow(entry : number) {
+    this.states = new Map();
+    this.worklist = [];
+    this.returns = {};
+    this.callers = {};
+    this.propagate(NO_SUBROUTINE, entry, this.START_CLOCKS, this.MAX_CLOCKS, -1);
+    while (this.worklist.length) {
+      var key = this.worklist.shift();
+      this.visitBlock(Math.floor(key / 0x10000), key & 0xffff, this.states.get(key));
+    }
+  }
+
+  visitBlock(sub : number, pc : number, state : ClockState) {
+    var blk = this.getBlock(pc);
+    var s = {min:state.min, max:state.max, cons:state.cons};
+    for (var insn of blk.insns) {
+      this.normalize(s);
+      if (!(s.min >= this.pc2minclocks[insn.pc])) this.pc2minclocks[insn.pc] = s.min;
+      if (!(s.max <= this.pc2maxclocks[insn.pc])) this.pc2maxclocks[insn.pc] = s.max;
+      var next = (insn.pc + insn.len) & 0xffff;
+      switch (insn.flow) {
+        case Flow.Next:
+          if (insn.clocks) {
+            s.min = insn.clocks[0];
+            s.max = insn.clocks[1];
           } else {
-            console.log("No JSR result!", hex(pc), hex(addr));
-            return;
+            s.min += insn.minCycles;
+            s.max += insn.maxCycles;
           }
+          s.cons = -1;
           break;
-        case 0x4c: // JMP
-          pc = addr; // TODO: make sure in ROM space
-          break;
-        case 0x40: // RTI
-          abort = true;
-          break;
-        case 0x60: // RTS
-          if (subaddr) { // TODO: 0 doesn't work
-            // TODO: combine with previous result
-            var result = this.jsrresult[subaddr];
-            if (!result) {
-              result = {minclocks:minclocks, maxclocks:maxclocks};
-            } else {
-              result = {
-                minclocks:Math.min(minclocks,result.minclocks),
-                maxclocks:Math.max(maxclocks,result.maxclocks)
-              }
-            }
-            this.jsrresult[subaddr] = result;
-            console.log("RTS", hex(pc), hex(subaddr), this.jsrresult[subaddr]);
-          }
+        case Flow.Jump:
+          this.propagate(sub, insn.target, s.min + insn.maxCycles, s.max + insn.maxCycles, -1);
           return;
-        case 0x10: case 0x30: // branch
-        case 0x50: case 0x70:
-        case 0x90: case 0xB0:
-        case 0xD0: case 0xF0:
-          var newpc = pc + byte2signed(lob);
-          var crosspage = (pc>>8) != (newpc>>8);
-          if (!crosspage) meta.maxCycles--;
-          // TODO: other instructions might modify flags too
-          var cons = BRANCH_CONSTRAINTS[Math.floor((meta.opcode-0x10)/0x20)];
-          var cons0 = constraintEquals(oldconstraints, cons[0]);
-          var cons1 = constraintEquals(oldconstraints, cons[1]);
-          // recursively trace the taken branch
-          if (true || cons0 !== false) { // TODO?
-            this.traceInstructions(newpc, minclocks+meta.maxCycles, maxclocks+meta.maxCycles, subaddr, cons[0]);
-          }
-          // abort if we will always take the branch
-          if (cons1 === false) {
-            console.log("branch always taken", hex(pc), oldconstraints, cons[1]);
-            abort = true;
-          }
-          constraints = cons[1]; // not taken
-          meta.maxCycles = meta.minCycles; // branch not taken, no extra clock(s)
-          break;
-        case 0x6c:
-          console.log("Instruction not supported!", hex(pc), hex(meta.opcode), meta); // TODO
+        case Flow.Branch:
+          var cons = insn.cons != null ? insn.cons : -1;
+          var sameflag = cons >= 0 && s.cons >= 0 && (s.cons >> 1) == (cons >> 1);
+          if (!sameflag || s.cons == cons)
+            this.propagate(sub, insn.target, s.min + insn.maxCycles, s.max + insn.maxCycles, cons);
+          if (!sameflag || s.cons == (cons ^ 1))
+            this.propagate(sub, next, s.min + insn.minCycles, s.max + insn.minCycles, cons >= 0 ? cons ^ 1 : -1);
+          return;
+        case Flow.CondCall:
+          this.propagate(sub, next, s.min + insn.minCycles, s.max + insn.minCycles, -1);
+          // fall through
+        case Flow.Call:
+          var retkey = sub * 0x10000 + next;
+          var callers = this.callers[insn.target] || (this.callers[insn.target] = []);
+          if (callers.indexOf(retkey) < 0) callers.push(retkey);
+          this.propagate(insn.target, insn.target, s.min + insn.maxCycles, s.max + insn.maxCycles, -1);
+          var ret = this.returns[insn.target];
+          if (ret) this.propagate(sub, next, ret.min, ret.max, -1);
+          return;
+        case Flow.CondReturn:
+          this.propagate(sub, next, s.min + insn.minCycles, s.max + insn.minCycles, -1);
+          // fall through
+        case Flow.Return:
+          this.propagateReturn(sub, s.min + insn.maxCycles, s.max + insn.maxCycles);
+          return;
+        case Flow.Stop:
           return;
       }
-      // add min/max instruction time to min/max clocks bound
-      minclocks += meta.minCycles;
-      maxclocks += meta.maxCycles;
     }
+    // fell through into the next block
+    var last = blk.insns[blk.insns.length-1];
+    this.propagate(sub, (last.pc + last.len) & 0xffff, s.min, s.max, -1);
   }
+}
 
-  showLoopTimingForPC(pc:number) {
-    this.pc2minclocks = {};
-    this.pc2maxclocks = {};
-    this.jsrresult = {};
-    // recurse through all traces
-    this.traceInstructions(pc | this.platform.getOriginPC(), this.START_CLOCKS, this.MAX_CLOCKS, 0, {});
+/// 6502 (VCS, NES)
+
+const ABS_INDEXED_OPCODES = [
+  0x19, 0x1d, 0x39, 0x3d, 0x59, 0x5d, 0x79, 0x7d, 0x99, 0x9d,
+  0xa9, 0xad, 0xb9, 0xbd, 0xbc, 0xbe, 0xd9, 0xdd, 0xf9, 0xfd
+];
+
+abstract class CodeAnalyzer6502 extends CodeAnalyzerBase {
+
+  getEntryPC(pc : number) : number {
+    return pc | this.platform.getOriginPC();
+  }
+
+  isROM(addr : number) : boolean {
+    return addr >= 0x8000;
+  }
+
+  decodeInsn(pc : number) : AnalyzedInsn {
+    var opcode = this.platform.readAddress(pc);
+    var meta = this.platform.getOpcodeMetadata(opcode, pc);
+    var lob = this.platform.readAddress((pc+1) & 0xffff);
+    var hib = this.platform.readAddress((pc+2) & 0xffff);
+    var addr = lob + (hib << 8);
+    var insn : AnalyzedInsn = {pc:pc, len:meta.insnlength, minCycles:meta.minCycles, maxCycles:meta.maxCycles, flow:Flow.Next};
+    if (!meta.insnlength) {
+      console.log("Illegal instruction!", hex(pc), hex(opcode), meta);
+      insn.len = 1;
+      insn.flow = Flow.Stop;
+      return insn;
+    }
+    var next = (pc + insn.len) & 0xffff;
+    if (ABS_INDEXED_OPCODES.indexOf(opcode) >= 0 && lob == 0 && insn.maxCycles > insn.minCycles) {
+      insn.maxCycles -= 1; // no page boundary crossed
+    }
+    switch (opcode) {
+      case 0x20: // JSR
+        insn.flow = Flow.Call;
+        insn.target = addr;
+        break;
+      case 0x4c: // JMP
+        insn.flow = Flow.Jump;
+        insn.target = addr;
+        break;
+      case 0x6c: // JMP (ind), only if the vector is in ROM (and with the page wrap bug)
+        if (this.isROM(addr)) {
+          insn.flow = Flow.Jump;
+          insn.indirect = true;
+          insn.target = this.platform.readAddress(addr)
+                      + (this.platform.readAddress((addr & 0xff00) | ((addr + 1) & 0xff)) << 8);
+        } else {
+          insn.flow = Flow.Stop;
+        }
+        break;
+      case 0x00: // BRK
+      case 0x40: // RTI
+        insn.flow = Flow.Stop;
+        break;
+      case 0x60: // RTS
+        insn.flow = Flow.Return;
+        break;
+      case 0x10: case 0x30: // branch
+      case 0x50: case 0x70:
+      case 0x90: case 0xB0:
+      case 0xD0: case 0xF0:
+        insn.flow = Flow.Branch;
+        insn.target = (next + byte2signed(lob)) & 0xffff;
+        if ((next>>8) == (insn.target>>8)) insn.maxCycles--; // no page crossed
+        // [N,V,C,Z] flag, and its value when taken
+        insn.cons = (opcode-0x10) >> 5;
+        break;
+    }
+    if (insn.flow != Flow.Branch && insn.target != null && !this.isROM(insn.target)) {
+      insn.flow = Flow.Stop; // don't follow into RAM
+    }
+    this.adjustInsn(insn, opcode, lob, hib);
+    return insn;
+  }
+
+  adjustInsn(insn : AnalyzedInsn, opcode : number, lob : number, hib : number) {
   }
 }
 
@@ -215,6 +392,15 @@ export class CodeAnalyzer_vcs extends CodeAnalyzer6502 {
     this.MAX_CLOCKS = this.START_CLOCKS = 76*2; // 2 scanlines
     this.WRAP_CLOCKS = false;
   }
+  getCacheName() { return "vcs"; }
+  isROM(addr : number) : boolean {
+    return (addr & 0x1000) != 0;
+  }
+  adjustInsn(insn : AnalyzedInsn, opcode : number, lob : number, hib : number) {
+    if (opcode == 0x85 && lob == 0x2) { // STA WSYNC
+      insn.clocks = [0, 0];
+    }
+  }
 }
 
 // https://wiki.nesdev.com/w/index.php/PPU_rendering#Line-by-line_timing
@@ -226,5 +412,142 @@ export class CodeAnalyzer_nes extends CodeAnalyzer6502 {
     this.START_CLOCKS = 0;
     this.WRAP_CLOCKS = true;
   }
+  getCacheName() { return "nes"; }
+  adjustInsn(insn : AnalyzedInsn, opcode : number, lob : number, hib : number) {
+    if (opcode == 0x2c && lob == 0x02 && hib == 0x20) { // BIT $2002 (sprite 0 poll)
+      insn.clocks = [0, 4]; // uncertainty b/c of assumed branch poll
+    }
+  }
+}
+
+/// Z80
+
+// unprefixed opcodes, not taken for conditionals (ld r,r' and alu r are filled in below)
+const Z80_CYCLES = [
+   4,10, 7, 6, 4, 4, 7, 4, 4,11, 7, 6, 4, 4, 7, 4,
+   8,10, 7, 6, 4, 4, 7, 4,12,11, 7, 6, 4, 4, 7, 4,
+   7,10,16, 6, 4, 4, 7, 4, 7,11,16, 6, 4, 4, 7, 4,
+   7,10,13, 6,11,11,10, 4, 7,11,13, 6, 4, 4, 7, 4,
+];
+const Z80_CYCLES_HI = [
+   5,10,10,10,10,11, 7,11, 5,10,10, 0,10,17, 7,11,
+   5,10,10,11,10,11, 7,11, 5, 4,10,11,10, 0, 7,11,
+   5,10,10,19,10,11, 7,11, 5, 4,10, 4,10, 0, 7,11,
+   5,10,10, 4,10,11, 7,11, 5, 6,10, 4,10, 0, 7,11,
+];
+
+function getCycles_z80(op : number) : number {
+  if (op < 0x40) return Z80_CYCLES[op];
+  if (op >= 0xc0) return Z80_CYCLES_HI[op - 0xc0];
+  // ld r,r' / alu r, 7 if (hl) is involved
+  return (op != 0x76 && ((op & 7) == 6 || (op >= 0x70 && op < 0x78))) ? 7 : 4;
+}
+
+function getCycles_z80_ED(op : number) : number {
+  if (op >= 0x40 && op < 0x80) {
+    switch (op & 7) {
+      case 0: case 1: return 12;  // in r,(c) / out (c),r
+      case 2: return 15;          // sbc/adc hl,rr
+      case 3: return 20;          // ld (nn),rr / ld rr,(nn)
+      case 4: case 6: return 8;   // neg / im
+      case 5: return 14;          // retn / reti
+      case 7: return op < 0x60 ? 9 : op < 0x70 ? 18 : 8; // ld i/r / rrd/rld
+    }
+  }
+  if ((op & 0xe4) == 0xa0) return 16; // block ops (not repeating)
+  return 8;
 }
 
+function uses_z80_HL(op : number) : boolean {
+  return op == 0x34 || op == 0x35 || op == 0x36
+      || (op >= 0x40 && op < 0xc0 && op != 0x76 && ((op & 7) == 6 || (op >= 0x70 && op < 0x78)));
+}
+
+export class CodeAnalyzer_z80 extends CodeAnalyzerBase {
+  constructor(platform : Platform, cyclesPerLine : number) {
+    super(platform);
+    this.MAX_CLOCKS = Math.round(cyclesPerLine);
+    this.START_CLOCKS = 0;
+    this.WRAP_CLOCKS = true;
+  }
+  getCacheName() { return "z80"; }
+
+  decodeInsn(pc : number) : AnalyzedInsn {
+    var read = (a) => { return this.platform.readAddress(a & 0xffff); };
+    var b0 = read(pc), b1 = read(pc+1), b2 = read(pc+2), b3 = read(pc+3);
+    var len = disassembleZ80(pc, b0, b1, b2, b3).nbytes;
+    var next = (pc + len) & 0xffff;
+    var insn : AnalyzedInsn = {pc:pc, len:len, minCycles:4, maxCycles:4, flow:Flow.Next};
+    var cycles = function(min:number, max?:number) {
+      insn.minCycles = min;
+      insn.maxCycles = max != null ? max : min;
+    };
+    switch (b0) {
+      case 0xcb:
+        cycles((b1 & 7) != 6 ? 8 : (b1 >= 0x40 && b1 < 0x80) ? 12 : 15);
+        return insn;
+      case 0xed:
+        cycles(getCycles_z80_ED(b1));
+        if ((b1 & 0xc7) == 0x45) { // retn / reti
+          insn.flow = Flow.Return;
+        } else if ((b1 & 0xe4) == 0xa0 && (b1 & 0x10)) { // ldir, cpir, inir, otir...
+          insn.flow = Flow.Branch;
+          insn.target = pc;
+          cycles(16, 21);
+        }
+        return insn;
+      case 0xdd:
+      case 0xfd:
+        if (b1 == 0xcb) {
+          cycles((b3 >= 0x40 && b3 < 0x80) ? 20 : 23);
+        } else if (b1 == 0xe9) { // jp (ix)
+          cycles(8);
+          insn.flow = Flow.Stop;
+        } else if (uses_z80_HL(b1)) {
+          cycles((b1 == 0x34 || b1 == 0x35) ? 23 : 19);
+        } else {
+          cycles(getCycles_z80(b1) + 4);
+        }
+        return insn;
+    }
+    cycles(getCycles_z80(b0));
+    var rel = (next + byte2signed(b1)) & 0xffff;
+    var abs = b1 + (b2 << 8);
+    if (b0 == 0x10) { // djnz
+      insn.flow = Flow.Branch;
+      insn.target = rel;
+      cycles(8, 13);
+    } else if (b0 == 0x18) { // jr
+      insn.flow = Flow.Jump;
+      insn.target = rel;
+    } else if ((b0 & 0xe7) == 0x20) { // jr cc
+      insn.flow = Flow.Branch;
+      insn.target = rel;
+      cycles(7, 12);
+    } else if (b0 == 0xc3) { // jp
+      insn.flow = Flow.Jump;
+      insn.target = abs;
+    } else if ((b0 & 0xc7) == 0xc2) { // jp cc
+      insn.flow = Flow.Branch;
+      insn.target = abs;
+    } else if (b0 == 0xcd) { // call
+      insn.flow = Flow.Call;
+      insn.target = abs;
+    } else if ((b0 & 0xc7) == 0xc4) { // call cc
+      insn.flow = Flow.CondCall;
+      insn.target = abs;
+      cycles(10, 17);
+    } else if ((b0 & 0xc7) == 0xc7) { // rst
+      insn.flow = Flow.Call;
+      insn.target = b0 & 0x38;
+    } else if (b0 == 0xc9) { // ret
+      insn.flow = Flow.Return;
+    } else if ((b0 & 0xc7) == 0xc0) { // ret cc
+      insn.flow = Flow.CondReturn;
+      cycles(5, 11);
+    } else if (b0 == 0xe9 || b0 == 0x76) { // jp (hl), halt
+      insn.flow = Flow.Stop;
+    }
+    return insn;
+  }
+}
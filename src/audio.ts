@@ -2,6 +2,14 @@
 
 // from TSS
 declare var MasterChannel, AudioLooper, PsgDeviceChannel;
+// es2017 shared memory (not in our lib)
+declare var SharedArrayBuffer, Atomics;
+
+// set while a platform runs frames that shouldn't be heard (e.g. run-ahead)
+var audioSuppressed = false;
+export function setAudioSuppressed(suppress:boolean) {
+  audioSuppressed = suppress;
+}
 
 export class MasterAudio {
   master = new MasterChannel();
@@ -235,23 +243,38 @@ export var POKEYDeviceChannel = function() {
 
 ////// Worker sound
 
+var WORKER_RING_SIZE = 0x4000; // Int16 samples, power of 2
+
+// Sound CPU running in a worker, one main-CPU frame at a time.
+// Commands are stamped with the main CPU clock (relative to the frame start)
+// and sent along with the frame; samples come back through a ring that lives
+// in a SharedArrayBuffer when available, or is filled from messages otherwise.
 export var WorkerSoundChannel = function(worker) {
   var sampleRate;
   var output;
-  var pending = [];
-  var pendingLength = 0;
+  var cmds = [];
+  var primed = false;
+  var mask = WORKER_RING_SIZE - 1;
+  var shared = typeof SharedArrayBuffer !== 'undefined' && typeof Atomics !== 'undefined';
+  var sab = shared ? new SharedArrayBuffer(8 + WORKER_RING_SIZE*2) : new ArrayBuffer(8 + WORKER_RING_SIZE*2);
+  var header = new Int32Array(sab, 0, 2); // [write index, read index]
+  var ring = new Int16Array(sab, 8, WORKER_RING_SIZE);
 
   worker.onmessage = function(e) {
-    if (e && e.data && e.data.samples && output) {
-      pending.push(e.data.samples);
-      pendingLength += e.data.samples.length;
+    if (e && e.data && e.data.samples) {
+      var buf = e.data.samples;
+      var len = e.data.length;
+      var wp = header[0];
+      for (var i=0; i<len; i++)
+        ring[(wp + i) & mask] = buf[i];
+      header[0] = (wp + len) | 0;
+      worker.postMessage({recycle:buf}, [buf.buffer]);
     }
   };
 
   this.setBufferLength = function (length) {
     output = new Int16Array(length);
-    //worker.postMessage({bufferLength:length,numChannels:2});
-    pendingLength = 0;
+    primed = false;
   };
 
   this.getBuffer = function () {
@@ -260,29 +283,43 @@ export var WorkerSoundChannel = function(worker) {
 
   this.setSampleRate = function (rate) {
     sampleRate = rate;
-    worker.postMessage({sampleRate:rate});
+    worker.postMessage({sampleRate:rate, ring:shared ? sab : null});
+  };
+
+  // queue a sound command at main CPU clock 'clk' in the current frame
+  this.sendCommand = function(clk:number, value:number) {
+    cmds.push(clk, value);
+  };
+
+  // end of a main-CPU frame of 'cycles' clocks: run the sound CPU for it
+  this.endFrame = function(cycles:number) {
+    if (audioSuppressed) {
+      cmds.length = 0; // they'll be sent again when the frame is run for real
+    } else if (cycles > 0) {
+      worker.postMessage({frame:cycles, cmds:cmds});
+      cmds.length = 0;
+    }
   };
 
   this.generate = function (length) {
-    if (pendingLength < length*3) {
-      //console.log(length, pendingLength);
+    var wp = shared ? Atomics.load(header, 0) : header[0];
+    var rp = header[1];
+    var avail = (wp - rp) | 0;
+    // wait for a few buffers before (re)starting, drop samples if we fall too far behind
+    if (!primed && avail < length*3) {
       output.fill(0);
-      return; // TODO: send sync msg?
+      return;
     }
-    for (var i=0; i<output.length;) {
-      if (pending.length == 0) break; // TODO?
-      var buf = pending.shift();
-      pendingLength -= buf.length;
-      var l = output.length-i;
-      if (buf.length < l) {
-        output.set(buf, i);
-      } else {
-        output.set(buf.slice(0, l), i);
-        pending.unshift(buf.slice(l));
-        pendingLength += buf.length-l;
-      }
-      i += buf.length;
+    if (avail > length*8) {
+      rp = (wp - length*3) | 0;
+      avail = length*3;
     }
+    primed = avail >= length;
+    var n = Math.min(avail, length);
+    for (var i=0; i<n; i++)
+      output[i] = ring[(rp + i) & mask];
+    output.fill(0, n);
+    header[1] = (rp + n) | 0;
   }
 
 }
@@ -389,16 +426,52 @@ export var SampleAudio = function(clockfreq) {
     }
   }
 
-  this.feedSample = function(value, count) {
-    while (count-- > 0) {
-      accum += value;
-      sfrac += sinc;
-      while (sfrac >= 1) {
-        sfrac -= 1;
-        value *= sfrac;
-        this.addSingleSample(accum - value);
-        accum = value;
-      }
+  // box-filter one input sample into the output rate
+  function resample(value) {
+    accum += value;
+    sfrac += sinc;
+    while (sfrac >= 1) {
+      sfrac -= 1;
+      value *= sfrac;
+      self.addSingleSample(accum - value);
+      accum = value;
     }
   }
+
+  this.feedSample = function(value, count) {
+    if (audioSuppressed) return;
+    while (count-- > 0)
+      resample(value);
+  }
+
+  // one sample per entry, e.g. a frame's worth collected by the platform
+  this.feedBlock = function(block:Float32Array, count:number) {
+    if (!buffer || audioSuppressed) return;
+    for (var i=0; i<count; i++)
+      resample(block[i]);
+  }
+}
+
+// mono 16-bit PCM .wav file
+export function encodeWAV(samples:Int16Array, sampleRate:number) : Uint8Array {
+  var data = new Uint8Array(44 + samples.length*2);
+  var dv = new DataView(data.buffer);
+  var str = function(ofs:number, s:string) {
+    for (var i=0; i<s.length; i++) data[ofs+i] = s.charCodeAt(i);
+  };
+  str(0, "RIFF");
+  dv.setUint32(4, 36 + samples.length*2, true);
+  str(8, "WAVEfmt ");
+  dv.setUint32(16, 16, true);
+  dv.setUint16(20, 1, true); // PCM
+  dv.setUint16(22, 1, true); // channels
+  dv.setUint32(24, sampleRate, true);
+  dv.setUint32(28, sampleRate*2, true);
+  dv.setUint16(32, 2, true);
+  dv.setUint16(34, 16, true);
+  str(36, "data");
+  dv.setUint32(40, samples.length*2, true);
+  for (var i=0; i<samples.length; i++)
+    dv.setInt16(44 + i*2, samples[i], true);
+  return data;
 }
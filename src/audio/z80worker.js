@@ -46,16 +46,19 @@ var dac = 0;
 var current_buffer;
 var last_tstate;
 
-var timer;
-var curTime;
-var timerPeriod = 20;
 var sampleRate;
 var numChannels = 2;
-var bufferLength;
-
-var cpuFrequency = 18432000/6; // 3.072 MHz
-var cpuCyclesPerFrame = cpuFrequency/60;
 var cpuAudioFactor = 32;
+var framesPerSecond = 60;
+var sampleAccum = 0;
+
+// output ring, shared with WorkerSoundChannel when SharedArrayBuffer is available
+// ringHeader = [write index, read index] (in Int16 units, free-running)
+var ringHeader;
+var ring;
+var ringMask;
+// without a shared ring, frames are posted back and recycled through this pool
+var spareBuffers = [];
 
 rom = new RAM(0x4000).mem;
 // sample: [0xe,0x0,0x6,0x0,0x78,0xb9,0x30,0x06,0xa9,0xd3,0x00,0x04,0x18,0xf6,0x0c,0x79,0xd6,0xff,0x38,0xee,0x76,0x18,0xea];
@@ -96,54 +99,71 @@ function start() {
     memory: membus,
     ioBus: iobus
   });
-  current_buffer = new Int16Array(bufferLength);
+  // room for the longest frame (plus one for the fractional sample)
+  current_buffer = new Int16Array(numChannels * (Math.ceil(sampleRate / framesPerSecond) + 1));
   console.log('started audio');
 }
 
-function timerCallback() {
+function runTo(numStates) {
+  if (cpu.getHalted())
+    cpu.setTstates(numStates);
+  else
+    cpu.runFrame(numStates);
+}
+
+// run one main-CPU frame's worth of sound CPU cycles
+// cmds = [clock, value, ...], clocks relative to the start of a frame of mainCycles
+function runFrame(mainCycles, cmds) {
+  sampleAccum += sampleRate / framesPerSecond;
+  var numSamples = Math.floor(sampleAccum);
+  sampleAccum -= numSamples;
+  var numStates = numSamples * cpuAudioFactor;
   cpu.setTstates(0);
   last_tstate = 0;
-  var numStates = Math.floor(bufferLength * cpuAudioFactor / numChannels);
-  cpu.runFrame(numStates);
-  //console.log(numStates, cpu.getTstates());
-  cpu.setTstates(numStates); // TODO?
-  fillBuffer();
-  postMessage({samples:current_buffer});
-  if (!cpu.getHalted()) {
-    curTime += timerPeriod;
-    var dt = curTime - new Date().getTime();
-    if (dt < 0) dt = 0;
-    timer = setTimeout(timerCallback, dt);
-  } else {
-    timer = 0;
-    //console.log("HALT @ " + cpu.getPC());
+  for (var i=0; i<cmds.length; i+=2) {
+    runTo(Math.min(numStates, Math.floor(cmds[i] * numStates / mainCycles)));
+    command = cmds[i+1] & 0xff;
+    cpu.reset();
   }
+  runTo(numStates);
+  cpu.setTstates(numStates);
+  fillBuffer();
+  writeSamples(current_buffer, numSamples * numChannels);
 }
 
-function reset() {
-  if (!bufferLength) return;
-  cpu.reset();
-  if (!timer) {
-    curTime = new Date().getTime() - timerPeriod*4;
-    timerCallback();
+function writeSamples(buf, len) {
+  if (ring) {
+    var wp = Atomics.load(ringHeader, 0);
+    for (var i=0; i<len; i++)
+      ring[(wp + i) & ringMask] = buf[i];
+    Atomics.store(ringHeader, 0, (wp + len) | 0);
+  } else {
+    var out = spareBuffers.pop() || new Int16Array(buf.length);
+    out.set(buf);
+    postMessage({samples:out, length:len}, [out.buffer]);
   }
 }
 
 onmessage = function(e) {
   if (e && e.data) {
-    if (e.data.command) {
-      command = e.data.command & 0xff;
-      reset();
+    if (e.data.frame) {
+      if (cpu) runFrame(e.data.frame, e.data.cmds);
+    } else if (e.data.recycle) {
+      spareBuffers.push(e.data.recycle);
     } else if (e.data.sampleRate) {
       console.log(e.data);
       sampleRate = e.data.sampleRate;
-      bufferLength = numChannels*sampleRate*timerPeriod/1000;
+      if (e.data.ring) {
+        ringHeader = new Int32Array(e.data.ring, 0, 2);
+        ring = new Int16Array(e.data.ring, 8);
+        ringMask = ring.length - 1;
+      }
       start();
-      reset();
+      cpu.reset();
     } else if (e.data.rom) {
       rom = e.data.rom;
       command = 0x0;
-      reset();
+      if (cpu) cpu.reset();
     }
   }
 }
@@ -4,6 +4,7 @@ import { hex, printFlags, invertMap } from "./util";
 import { CodeAnalyzer } from "./analysis";
 import { disassemble6502 } from "./cpu/disasm6502";
 import { disassembleZ80 } from "./cpu/disasmz80";
+import { setAudioSuppressed } from "./audio";
 
 declare var Z80_fast, jt, CPU6809;
 
@@ -98,11 +99,21 @@ export interface Platform {
 
   setRecorder?(recorder : EmuRecorder) : void;
   advance?(novideo? : boolean) : void;
+  setRunAhead?(frames : number) : void;
+  getRunAheadStats?() : RunAheadStats;
+  setTurbo?(frames : number) : void;
+  getTurbo?() : number;
+  getEmulatedFrameRate?() : number;
   showHelp?(tool:string, ident?:string) : void;
   resize?() : void;
 
   startProfiling?() : ProfilerOutput;
   stopProfiling?() : void;
+  startSampling?() : SamplingProfiler;
+  stopSampling?() : void;
+  startInstrumentation?() : MemoryInstrumentation;
+  stopInstrumentation?() : void;
+  getProbe?() : any;
   getRasterScanline?() : number;
 
   debugSymbols? : DebugSymbols;
@@ -126,28 +137,149 @@ export type BreakpointCallback = (s:EmuState) => void;
 // for composite breakpoints w/ single debug function
 export class BreakpointList {
   id2bp : {[id:string] : Breakpoint} = {};
-  getDebugCondition() : DebugCondition {
-    if (Object.keys(this.id2bp).length == 0) {
+  compiled : DebugCondition = null;
+  dirty = true;
+  // filters, rebuilt by compile()
+  pcmap : Uint8Array = null;
+  watchmap : Uint8Array = null;
+  watchhit = false;
+  minclock = 0;
+  pcOnly = false; // every breakpoint has a PC filter, so the CPU can run to pcmap
+
+  add(id : string, bp : Breakpoint) {
+    this.id2bp[id] = bp;
+    this.dirty = true;
+  }
+  remove(id : string) {
+    if (this.id2bp[id]) {
+      delete this.id2bp[id];
+      this.dirty = true;
+    }
+  }
+  // called by the memory bus when watchpoints are set
+  memoryAccessed(addr : number) {
+    if (this.watchmap[addr & 0xffff]) this.watchhit = true;
+  }
+  // shift clock filters when the platform rebases its clock
+  rebaseClock(delta : number) {
+    for (var id in this.id2bp) {
+      var bp = this.id2bp[id];
+      if (bp.clock != null) bp.clock += delta;
+    }
+    this.minclock += delta;
+  }
+  getDebugCondition(hooks? : BreakpointHooks) : DebugCondition {
+    if (this.dirty) {
+      this.compiled = this.compile(hooks || {});
+      this.dirty = false;
+    }
+    return this.compiled;
+  }
+  // turn filtered breakpoints into table lookups,
+  // so cond() is only called when a filter matches
+  compile(hooks : BreakpointHooks) : DebugCondition {
+    var getPC = hooks.getPC;
+    var getClock = hooks.getClock;
+    var slow : DebugCondition[] = [];
+    var pcconds : DebugCondition[] = [];
+    var clockconds : DebugCondition[] = [];
+    var watchconds : DebugCondition[] = [];
+    this.pcmap = null;
+    this.watchmap = null;
+    this.watchhit = false;
+    this.minclock = Number.MAX_VALUE;
+    for (var id in this.id2bp) {
+      var bp = this.id2bp[id];
+      if (bp.pcs && getPC) {
+        if (!this.pcmap) this.pcmap = new Uint8Array(0x10000);
+        for (var pc of bp.pcs)
+          this.pcmap[pc & 0xffff] = 1;
+        pcconds.push(bp.cond);
+      } else if (bp.clock != null && getClock) {
+        this.minclock = Math.min(this.minclock, bp.clock);
+        clockconds.push(bp.cond);
+      } else if (bp.watch && hooks.watch) {
+        if (!this.watchmap) this.watchmap = new Uint8Array(0x10000);
+        this.watchmap.fill(1, bp.watch[0] & 0xffff, (bp.watch[1] & 0xffff) + 1);
+        watchconds.push(bp.cond);
+      } else {
+        slow.push(bp.cond);
+      }
+    }
+    var nconds = slow.length + pcconds.length + clockconds.length + watchconds.length;
+    this.pcOnly = nconds > 0 && pcconds.length == nconds;
+    if (nconds == 0) {
       return null; // no breakpoints
-    } else {
-      // evaluate all breakpoints
-      return () => {
-        var result = false;
-        for (var id in this.id2bp)
-          if (this.id2bp[id].cond())
-            result = true;
-        return result;
-      };
+    } else if (slow.length == 1 && nconds == 1) {
+      return slow[0];
     }
+    var pcmap = this.pcmap;
+    return () => {
+      var result = false;
+      for (var i=0; i<slow.length; i++)
+        if (slow[i]()) result = true;
+      if (pcmap && pcmap[getPC()])
+        for (var i=0; i<pcconds.length; i++)
+          if (pcconds[i]()) result = true;
+      if (clockconds.length && getClock() >= this.minclock)
+        for (var i=0; i<clockconds.length; i++)
+          if (clockconds[i]()) result = true;
+      if (this.watchhit) {
+        this.watchhit = false;
+        for (var i=0; i<watchconds.length; i++)
+          if (watchconds[i]()) result = true;
+      }
+      return result;
+    };
   }
 }
-export type Breakpoint = {cond:DebugCondition};
+// what the platform can test cheaply
+export type BreakpointHooks = {
+  getPC? : () => number;
+  getClock? : () => number;
+  watch? : boolean;       // calls memoryAccessed() from the bus
+};
+export type BreakpointFilter = {
+  pcs? : number[];    // only test at these PCs
+  clock? : number;    // only test once the platform clock reaches this
+  watch? : number[];  // only test after an access to [start,end]
+};
+export type Breakpoint = BreakpointFilter & {cond:DebugCondition};
 
 export interface EmuRecorder {
   frameRequested() : boolean;
   recordFrame(state : EmuState);
 }
 
+const TURBO_BUDGET_MSEC = 12; // of a 16.7 msec tick, leaving room for the shown frame
+
+function getTimeMsec() : number {
+  return typeof performance !== 'undefined' ? performance.now() : Date.now();
+}
+
+// where the time goes when running ahead, summed over all ticks
+export class RunAheadStats {
+  ticks = 0;
+  frameMsec = 0;  // the real frame
+  aheadMsec = 0;  // frames run ahead (then thrown away)
+  saveMsec = 0;   // saveState() before running ahead
+  loadMsec = 0;   // loadState() to roll back, including the display repaint
+
+  reset() {
+    this.ticks = this.frameMsec = this.aheadMsec = this.saveMsec = this.loadMsec = 0;
+  }
+  // extra CPU per tick, relative to just running the real frame
+  getOverhead() : number {
+    return (this.aheadMsec + this.saveMsec + this.loadMsec) / (this.frameMsec || 1);
+  }
+  toString() : string {
+    var n = this.ticks || 1;
+    return "frame " + (this.frameMsec/n).toFixed(3) + " ms, ahead " + (this.aheadMsec/n).toFixed(3)
+      + " ms, save " + (this.saveMsec/n).toFixed(3) + " ms, load " + (this.loadMsec/n).toFixed(3)
+      + " ms, overhead " + (this.getOverhead()*100).toFixed(0) + "%";
+  }
+}
+
 export interface ProfilerScanline {
   start,end : number; // start/end frameindex
 }
@@ -159,6 +291,122 @@ export interface ProfilerOutput {
   frame : ProfilerFrame;
 }
 
+const PROFILER_RING_SIZE = 0x10000; // samples between aggregations
+const PROFILER_MAX_DEPTH = 256;
+const PROFILER_MAX_INSNLEN = 5; // PC moved further than this = jump
+
+// samples PC/SP/cycles from CPU run loops into a ring without allocating,
+// then aggregates per-PC cycles and a call tree inferred from SP
+export class SamplingProfiler {
+  ring_pc = new Uint16Array(PROFILER_RING_SIZE);
+  ring_sp = new Uint16Array(PROFILER_RING_SIZE);
+  ring_cycles = new Uint32Array(PROFILER_RING_SIZE);
+  count = 0;
+  // flat profile
+  pccycles = new Float64Array(0x10000);
+  totalcycles = 0;
+  // call tree, node 0 is the root
+  node_pc : number[] = [-1];
+  node_parent : number[] = [-1];
+  node_cycles : number[] = [0];
+  node_children : {[key:number]:number} = {};
+  // shadow call stack
+  stack_node = new Int32Array(PROFILER_MAX_DEPTH);
+  stack_sp = new Int32Array(PROFILER_MAX_DEPTH);
+  depth = 0;
+  lastpc = -1;
+  lastsp = -1;
+
+  record(pc:number, sp:number, cycles:number) {
+    var i = this.count++;
+    this.ring_pc[i] = pc;
+    this.ring_sp[i] = sp;
+    this.ring_cycles[i] = cycles;
+    if (this.count == PROFILER_RING_SIZE)
+      this.flush();
+  }
+
+  flush() {
+    for (var i=0; i<this.count; i++)
+      this.aggregate(this.ring_pc[i], this.ring_sp[i], this.ring_cycles[i]);
+    this.count = 0;
+  }
+
+  aggregate(pc:number, sp:number, cycles:number) {
+    this.pccycles[pc] += cycles;
+    this.totalcycles += cycles;
+    // pop frames we have returned from
+    while (this.depth > 0 && sp > this.stack_sp[this.depth-1])
+      this.depth--;
+    // SP dropped and PC jumped: call or interrupt
+    if (sp < this.lastsp && (pc < this.lastpc || pc > this.lastpc + PROFILER_MAX_INSNLEN) && this.depth < PROFILER_MAX_DEPTH) {
+      var parent = this.depth ? this.stack_node[this.depth-1] : 0;
+      var key = parent * 0x10000 + pc;
+      var node = this.node_children[key];
+      if (node === undefined) {
+        node = this.node_children[key] = this.node_pc.length;
+        this.node_pc.push(pc);
+        this.node_parent.push(parent);
+        this.node_cycles.push(0);
+      }
+      this.stack_node[this.depth] = node;
+      this.stack_sp[this.depth] = sp;
+      this.depth++;
+    }
+    this.node_cycles[this.depth ? this.stack_node[this.depth-1] : 0] += cycles;
+    this.lastpc = pc;
+    this.lastsp = sp;
+  }
+
+  // nearest symbol at or below each address
+  // rebuilt only when the debug symbols change
+  symtab : string[] = null;
+  symtab_src : {[address:number]:string} = null;
+
+  getSymbolTable(addr2symbol:{[address:number]:string}) : string[] {
+    if (this.symtab && this.symtab_src === addr2symbol)
+      return this.symtab;
+    var symtab = new Array(0x10000);
+    var sym = null;
+    for (var a=0; a<0x10000; a++) {
+      if (addr2symbol && addr2symbol[a]) sym = addr2symbol[a];
+      symtab[a] = sym || ('$' + hex(a,4));
+    }
+    this.symtab_src = addr2symbol;
+    return this.symtab = symtab;
+  }
+
+  // self cycles per symbol, most expensive first
+  getFlatProfile(addr2symbol:{[address:number]:string}) : {name:string, cycles:number}[] {
+    this.flush();
+    var symtab = this.getSymbolTable(addr2symbol);
+    var totals = {};
+    for (var pc=0; pc<0x10000; pc++) {
+      var cyc = this.pccycles[pc];
+      if (cyc) totals[symtab[pc]] = (totals[symtab[pc]] || 0) + cyc;
+    }
+    var result = Object.keys(totals).map((name) => { return {name:name, cycles:totals[name]}; });
+    result.sort((a,b) => { return b.cycles - a.cycles; });
+    return result;
+  }
+
+  // "outer;inner cycles" lines, for flame graph tools
+  getCollapsedStacks(addr2symbol:{[address:number]:string}) : string {
+    this.flush();
+    var symtab = this.getSymbolTable(addr2symbol);
+    var s = "";
+    for (var n=0; n<this.node_pc.length; n++) {
+      if (!this.node_cycles[n]) continue;
+      var path = [];
+      for (var m=n; m>0; m=this.node_parent[m])
+        path.unshift(symtab[this.node_pc[m]]);
+      path.unshift("(root)");
+      s += path.join(';') + " " + this.node_cycles[n] + "\n";
+    }
+    return s;
+  }
+}
+
 /////
 
 export abstract class BasePlatform {
@@ -190,20 +438,22 @@ export abstract class BaseDebugPlatform extends BasePlatform {
   debugTargetClock : number = 0;
   debugClock : number = 0;
   breakpoints : BreakpointList = new BreakpointList();
+  probe;
+  instrumentation : MemoryInstrumentation = null;
 
   abstract getCPUState() : CpuState;
   abstract readAddress(addr:number) : number;
 
-  setBreakpoint(id : string, cond : DebugCondition) {
+  setBreakpoint(id : string, cond : DebugCondition, filter? : BreakpointFilter) {
     if (cond) {
-      this.breakpoints.id2bp[id] = {cond:cond};
+      this.breakpoints.add(id, {cond:cond, pcs:filter && filter.pcs, clock:filter && filter.clock, watch:filter && filter.watch});
       this.restartDebugging();
     } else {
       this.clearBreakpoint(id);
     }
   }
   clearBreakpoint(id : string) {
-    delete this.breakpoints.id2bp[id];
+    this.breakpoints.remove(id);
   }
   startProfiling() : ProfilerOutput {
     var frame = null;
@@ -225,8 +475,10 @@ export abstract class BaseDebugPlatform extends BasePlatform {
         start = i;
         lastsl = sl;
       }
-      var c = this.getCPUState();
-      frame.iptab[i++] = c.EPC || c.PC;
+      if (i < frame.iptab.length) { // drop samples on busy frames
+        var c = this.getCPUState();
+        frame.iptab[i++] = c.EPC || c.PC;
+      }
       return false; // profile forever
     });
     return output;
@@ -234,8 +486,24 @@ export abstract class BaseDebugPlatform extends BasePlatform {
   stopProfiling() {
     this.clearBreakpoint('profile');
   }
+  getBreakpointHooks() : BreakpointHooks {
+    return null;
+  }
+  wasBreakpointHit() : boolean {
+    return this.debugBreakState != null;
+  }
+  probeWatching = false;
   getDebugCallback() : DebugCondition {
-    return this.breakpoints.getDebugCondition();
+    var debugCond = this.breakpoints.getDebugCondition(this.getBreakpointHooks());
+    // route bus accesses to watchpoints, if any
+    if (this.breakpoints.watchmap && !this.probeWatching) {
+      this.probe.activate((a) => { this.breakpoints.memoryAccessed(a); });
+      this.probeWatching = true;
+    } else if (!this.breakpoints.watchmap && this.probeWatching) {
+      this.probe.deactivate();
+      this.probeWatching = false;
+    }
+    return debugCond;
   }
   setupDebug(callback : BreakpointCallback) : void {
     this.onBreakpointHit = callback;
@@ -248,8 +516,8 @@ export abstract class BaseDebugPlatform extends BasePlatform {
     this.onBreakpointHit = null;
     this.clearBreakpoint('debug');
   }
-  setDebugCondition(debugCond : DebugCondition) {
-    this.setBreakpoint('debug', debugCond);
+  setDebugCondition(debugCond : DebugCondition, filter? : BreakpointFilter) {
+    this.setBreakpoint('debug', debugCond, filter);
   }
   restartDebugging() {
     if (this.debugSavedState) {
@@ -262,15 +530,114 @@ export abstract class BaseDebugPlatform extends BasePlatform {
     this.debugBreakState = null;
     this.resume();
   }
+  getProbe() { return this.probe; }
+  startInstrumentation() : MemoryInstrumentation {
+    if (!this.probe) return null;
+    this.instrumentation = new MemoryInstrumentation();
+    this.probe.instrument(this.instrumentation);
+    return this.instrumentation;
+  }
+  stopInstrumentation() {
+    if (this.probe) this.probe.instrument(null);
+    this.instrumentation = null;
+  }
   preFrame() {
     this.updateRecorder();
+    if (this.instrumentation) this.instrumentation.nextFrame();
   }
   postFrame() {
   }
   nextFrame(novideo : boolean) {
+    if (this.turboFrames != 0 && !novideo && !this.getDebugCallback())
+      this.runTurbo();
     this.preFrame();
-    this.advance(novideo);
+    if (this.runAheadFrames > 0 && !novideo && !this.instrumentation && !this.getDebugCallback())
+      this.runAhead(this.runAheadFrames);
+    else
+      this.advance(novideo);
     this.postFrame();
+    this.countFrames(1);
+  }
+
+  // Turbo: extra frames each tick before the one that's shown, without video
+  // or audio. N > 1 runs N frames per tick, -1 runs as many as fit in
+  // TURBO_BUDGET_MSEC, 0 is off.
+  turboFrames = 0;
+  emuFrames = 0;
+  emuFramesStart = 0;
+  emulatedFPS = 0;
+  setTurbo(frames : number) {
+    this.turboFrames = frames|0;
+  }
+  getTurbo() : number {
+    return this.turboFrames;
+  }
+  // emulated frames per (wall clock) second, updated about once a second
+  getEmulatedFrameRate() : number {
+    return this.emulatedFPS;
+  }
+  countFrames(n : number) {
+    var t = getTimeMsec();
+    if (this.emuFrames == 0) this.emuFramesStart = t;
+    this.emuFrames += n;
+    if (t - this.emuFramesStart >= 1000) {
+      this.emulatedFPS = (this.emuFrames - 1) * 1000 / (t - this.emuFramesStart);
+      this.emuFrames = 0;
+    }
+  }
+  runTurbo() {
+    var t0 = getTimeMsec();
+    setAudioSuppressed(true);
+    try {
+      for (var n=1; this.turboFrames < 0 ? getTimeMsec() - t0 < TURBO_BUDGET_MSEC : n < this.turboFrames; n++) {
+        this.preFrame();
+        this.advance(true);
+        this.postFrame();
+        this.countFrames(1);
+      }
+    } finally {
+      setAudioSuppressed(false);
+    }
+  }
+
+  // Run-ahead: run the real frame unseen, then run N more frames with the
+  // same inputs (unheard, only the last one drawn) and roll back, so the
+  // screen shows N frames into the future and hides the game's input lag.
+  // Costs N extra frames plus a saveState/loadState each tick. Platforms
+  // that keep display caches or draw at write time repaint only what
+  // loadState changes, so the rollback doesn't force a full redraw.
+  runAheadFrames = 0;
+  runAheadStats = new RunAheadStats();
+  setRunAhead(frames : number) {
+    this.runAheadFrames = Math.max(0, frames|0);
+    this.runAheadStats.reset();
+  }
+  getRunAheadStats() : RunAheadStats {
+    return this.runAheadStats;
+  }
+  runAhead(frames : number) {
+    var stats = this.runAheadStats;
+    var t0 = getTimeMsec();
+    this.advance(true);
+    var t1 = getTimeMsec();
+    var state = this.saveState();
+    var t2 = getTimeMsec();
+    setAudioSuppressed(true);
+    try {
+      for (var i=1; i<frames; i++)
+        this.advance(true);
+      this.advance(false);
+    } finally {
+      setAudioSuppressed(false);
+    }
+    var t3 = getTimeMsec();
+    this.loadState(state);
+    var t4 = getTimeMsec();
+    stats.ticks++;
+    stats.frameMsec += t1 - t0;
+    stats.saveMsec += t2 - t1;
+    stats.aheadMsec += t3 - t2;
+    stats.loadMsec += t4 - t3;
   }
 }
 
@@ -301,6 +668,30 @@ export abstract class Base6502Platform extends BaseDebugPlatform {
       this.debugCallback();
     }
   }
+  // the debug condition runs once per CPU clock, and debugClock counts those calls
+  getBreakpointHooks() : BreakpointHooks {
+    return {
+      getPC: () => { return this.getCPUState().PC; },
+      getClock: () => { return this.debugClock; },
+      watch: this.probe != null,
+    };
+  }
+  // also tells the instrumentation where each instruction starts
+  getDebugCallback() : DebugCondition {
+    var debugCond = super.getDebugCallback();
+    var inst = this.instrumentation;
+    if (!debugCond && !inst) return null;
+    return () => {
+      if (inst) {
+        var c = this.getCPUState();
+        if (c.T == 0) inst.execute(c.PC);
+      }
+      if (!debugCond) return false;
+      var hit = debugCond();
+      this.debugClock++;
+      return hit;
+    };
+  }
   postFrame() {
     if (this.debugCallback) {
       if (this.debugBreakState) {
@@ -310,6 +701,7 @@ export abstract class Base6502Platform extends BaseDebugPlatform {
         // save state every frame and rewind debug clocks
         this.debugSavedState = this.saveState();
         this.debugTargetClock -= this.debugClock;
+        this.breakpoints.rebaseClock(-this.debugClock);
         this.debugClock = 0;
       }
     }
@@ -325,67 +717,69 @@ export abstract class Base6502Platform extends BaseDebugPlatform {
   }
   runEval(evalfunc : DebugEvalCondition) {
     this.setDebugCondition( () => {
-      if (this.debugClock++ > this.debugTargetClock) {
+      if (this.debugClock > this.debugTargetClock) {
         var cpuState = this.getCPUState();
         if (evalfunc(cpuState)) {
-          this.breakpointHit(this.debugClock-1);
+          this.breakpointHit(this.debugClock);
           return true;
         } else {
           return false;
         }
       }
-    });
+    }, {clock:this.debugTargetClock+1});
   }
   runToFrameClock?(clock : number) : void {
     this.restartDebugging();
     this.debugTargetClock = clock;
     this.setDebugCondition( () => {
-      if (this.debugClock++ > this.debugTargetClock) {
-        this.breakpointHit(this.debugClock-1);
+      if (this.debugClock > this.debugTargetClock) {
+        this.breakpointHit(this.debugClock);
         return true;
       }
-    });
+    }, {clock:this.debugTargetClock+1});
   }
   step() {
     var previousPC = -1;
     this.setDebugCondition( () => {
       //console.log(this.debugClock, this.debugTargetClock, this.getCPUState().PC, this.getCPUState());
-      if (this.debugClock++ >= this.debugTargetClock) {
+      if (this.debugClock >= this.debugTargetClock) {
         var thisState = this.getCPUState();
         if (previousPC < 0) {
           previousPC = thisState.PC;
         } else {
           // doesn't work w/ endless loops
           if (thisState.PC != previousPC && thisState.T == 0) {
-            this.breakpointHit(this.debugClock-1);
+            this.breakpointHit(this.debugClock);
             return true;
           }
         }
       }
       return false;
-    });
+    }, {clock:this.debugTargetClock});
   }
   stepBack() {
     var prevState;
     var prevClock;
     this.setDebugCondition( () => {
-      if (this.debugClock++ >= this.debugTargetClock && prevState) {
+      var clock = this.debugClock;
+      if (clock >= this.debugTargetClock && prevState) {
         this.loadState(prevState);
-        this.breakpointHit(prevClock-1);
+        this.breakpointHit(prevClock);
         return true;
-      } else if (this.debugClock > this.debugTargetClock-10 && this.debugClock <= this.debugTargetClock+this.debugPCDelta) { // TODO: why this works?
+      } else if (clock >= this.debugTargetClock-10 && clock < this.debugTargetClock+this.debugPCDelta) { // TODO: why this works?
         if (this.getCPUState().T == 0) {
           prevState = this.saveState();
-          prevClock = this.debugClock;
+          prevClock = clock;
         }
       }
       return false;
-    });
+    }, {clock:this.debugTargetClock-10});
   }
 
   newCPU(membus : MemoryBus) {
     var cpu = new jt.M6502();
-    cpu.connectBus(membus);
+    this.probe = new BusProbe(membus);
+    cpu.connectBus(this.probe);
     return cpu;
   }
 
@@ -485,35 +879,201 @@ export function cpuStateToLongString_Z80(c) {
        ;
 }
 
+const INSTRUMENT_TIMELINE_FRAMES = 256;
+
+// per-address access counters, filled in by BusProbe while instrumenting
+export class MemoryInstrumentation {
+  reads = new Uint32Array(0x10000);
+  writes = new Uint32Array(0x10000);
+  execs = new Uint32Array(0x10000);       // instructions started here
+  overwrites = new Uint32Array(0x10000);  // writes with no read since the last write
+  lastWriterPC = new Int32Array(0x10000);
+  lastop = new Uint8Array(0x10000);
+  // accesses per frame, for the last N frames
+  frame = 0;
+  frameReads = new Uint32Array(INSTRUMENT_TIMELINE_FRAMES);
+  frameWrites = new Uint32Array(INSTRUMENT_TIMELINE_FRAMES);
+  // for views: the highest count so far, and which 16-byte rows were accessed
+  max = 1;
+  dirtyRows = new Uint8Array(0x1000);
+  pc = -1; // start of the current instruction
+
+  constructor() {
+    this.lastWriterPC.fill(-1);
+  }
+  // called by the platform's run loop before each instruction
+  execute(pc:number) {
+    pc &= 0xffff;
+    this.pc = pc;
+    if (++this.execs[pc] > this.max) this.max = this.execs[pc];
+    this.dirtyRows[pc >> 4] = 1;
+  }
+  read(a:number) {
+    a &= 0xffff;
+    var n = ++this.reads[a];
+    if (n > this.max) this.max = n;
+    this.dirtyRows[a >> 4] = 1;
+    this.lastop[a] = 1;
+    this.frameReads[this.frame & (INSTRUMENT_TIMELINE_FRAMES-1)]++;
+  }
+  write(a:number) {
+    a &= 0xffff;
+    if (++this.writes[a] > this.max) this.max = this.writes[a];
+    this.dirtyRows[a >> 4] = 1;
+    if (this.lastop[a] == 2)
+      this.overwrites[a]++;
+    this.lastop[a] = 2;
+    this.lastWriterPC[a] = this.pc;
+    this.frameWrites[this.frame & (INSTRUMENT_TIMELINE_FRAMES-1)]++;
+  }
+  nextFrame() {
+    var i = ++this.frame & (INSTRUMENT_TIMELINE_FRAMES-1);
+    this.frameReads[i] = 0;
+    this.frameWrites[i] = 0;
+  }
+}
+
+const JOURNAL_INSNS = 0x10000;  // instructions we can step back over
+const JOURNAL_WRITES = 0x40000; // overwritten bytes
+const JOURNAL_REGS = 20;        // numbers per CPU register record (see saveRegs())
+
+// undo log for stepping backwards: the CPU state before each instruction,
+// and the old value of each byte it wrote, in preallocated rings
+export class UndoJournal {
+  regs = new Float64Array(JOURNAL_INSNS * JOURNAL_REGS);
+  wstart = new Float64Array(JOURNAL_INSNS); // first write of each instruction
+  waddr = new Uint16Array(JOURNAL_WRITES);
+  wold = new Uint8Array(JOURNAL_WRITES);
+  ninsns = 0;   // instructions logged (not wrapped)
+  nwrites = 0;  // writes logged (not wrapped)
+  lowest = 0;   // oldest instruction still in the ring
+  lowestw = 0;  // oldest write still in the ring
+  active = false;
+  pending = false; // last write was logged
+  read : (a:number) => number;
+
+  constructor(read : (a:number) => number) {
+    this.read = read;
+  }
+  reset() {
+    this.ninsns = this.nwrites = this.lowest = this.lowestw = 0;
+  }
+  // nothing logged so far can be undone, e.g. after running unlogged instructions
+  forget() {
+    this.lowest = this.ninsns;
+    this.lowestw = this.nwrites;
+  }
+  logInstruction(cpu) {
+    var i = this.ninsns++ & (JOURNAL_INSNS-1);
+    cpu.saveRegs(this.regs, i * JOURNAL_REGS);
+    this.wstart[i] = this.nwrites;
+    if (this.ninsns - this.lowest > JOURNAL_INSNS) this.lowest = this.ninsns - JOURNAL_INSNS;
+  }
+  // called by the bus before a write
+  logWrite(a:number) {
+    this.pending = this.active && this.ninsns > this.lowest;
+    if (!this.pending) return;
+    var i = this.nwrites++ & (JOURNAL_WRITES-1);
+    this.waddr[i] = a;
+    this.wold[i] = this.read(a);
+    if (this.nwrites - this.lowestw > JOURNAL_WRITES) this.lowestw = this.nwrites - JOURNAL_WRITES;
+  }
+  // called after a write; forget it if the address doesn't read back (I/O)
+  checkWrite(a:number, v:number) {
+    if (this.pending && this.read(a) != (v & 0xff))
+      this.nwrites--;
+    this.pending = false;
+  }
+  canUndo(floor : number) : boolean {
+    return this.ninsns > Math.max(floor, this.lowest)
+        && this.wstart[(this.ninsns-1) & (JOURNAL_INSNS-1)] >= this.lowestw;
+  }
+  // restore the bytes written by the last instruction, and the CPU state before it
+  undo(write : (a:number, v:number) => void, cpu) {
+    var i = --this.ninsns & (JOURNAL_INSNS-1);
+    var ws = this.wstart[i];
+    while (this.nwrites > ws) {
+      var j = --this.nwrites & (JOURNAL_WRITES-1);
+      write(this.waddr[j], this.wold[j]);
+    }
+    cpu.loadRegs(this.regs, i * JOURNAL_REGS);
+  }
+  // drop everything after instruction n, before replaying from there
+  truncate(n : number) {
+    if (n < this.lowest) {
+      // instruction n is gone, so start over from there
+      this.ninsns = this.lowest = n;
+      this.lowestw = this.nwrites;
+    } else if (n < this.ninsns) {
+      this.nwrites = this.wstart[n & (JOURNAL_INSNS-1)];
+      this.ninsns = n;
+    }
+  }
+}
+
+// bus wrapper for debug callbacks, instrumentation and the undo journal,
+// which forwards straight to the bus when none are active
 export function BusProbe(bus : MemoryBus) {
+  var self = this;
   var active = false;
   var callback;
+  var instrument : MemoryInstrumentation = null;
+  var journal : UndoJournal = null;
+  var probedRead = function(a) {
+    if (active) {
+      callback(a);
+    }
+    if (instrument) {
+      instrument.read(a);
+    }
+    return bus.read(a);
+  }
+  var probedWrite = function(a,v) {
+    if (active) {
+      callback(a,v);
+    }
+    if (instrument) {
+      instrument.write(a);
+    }
+    if (journal) {
+      journal.logWrite(a);
+      bus.write(a,v);
+      journal.checkWrite(a,v);
+    } else {
+      bus.write(a,v);
+    }
+  }
+  function update() {
+    var probing = active || instrument != null || journal != null;
+    self.read = probing ? probedRead : bus.read.bind(bus);
+    self.write = probing ? probedWrite : bus.write.bind(bus);
+    if (self.onchange) self.onchange();
+  }
   this.activate = function(_callback) {
     active = true;
     callback = _callback;
+    update();
   }
   this.deactivate = function() {
     active = false;
     callback = null;
+    update();
   }
-  this.read = function(a) {
-    if (active) {
-      callback(a);
-    }
-    return bus.read(a);
+  this.instrument = function(_instrument : MemoryInstrumentation) {
+    instrument = _instrument;
+    update();
   }
-  this.write = function(a,v) {
-    if (active) {
-      callback(a,v);
-    }
-    bus.write(a,v);
+  this.journal = function(_journal : UndoJournal) {
+    journal = _journal;
+    update();
   }
+  this.bus = bus;
+  update();
 }
 
 export abstract class BaseZ80Platform extends BaseDebugPlatform {
 
   _cpu;
-  probe;
 
   newCPU(membus : MemoryBus, iobus : MemoryBus) {
     this.probe = new BusProbe(membus);
@@ -525,25 +1085,79 @@ export abstract class BaseZ80Platform extends BaseDebugPlatform {
    return this._cpu;
   }
 
-  getProbe() { return this.probe; }
   getPC() { return this._cpu.getPC(); }
   getSP() { return this._cpu.getSP(); }
 
+  // run loop records every instruction while sampling
+  profiler : SamplingProfiler = null;
+  startSampling() : SamplingProfiler {
+    return this.profiler = new SamplingProfiler();
+  }
+  stopSampling() {
+    this.profiler = null;
+  }
+
+  getBreakpointHooks() : BreakpointHooks {
+    return {
+      getPC: () => { return this._cpu.getPC(); },
+      getClock: () => { return this._cpu.getTstates(); },
+      watch: this.probe != null,
+    };
+  }
+  // compiled code blocks skip opcode fetches and run several instructions per step
+  canCacheCode(debugCond : DebugCondition) : boolean {
+    return !debugCond && !this.profiler && !this.instrumentation;
+  }
+  getDebugCallback() : DebugCondition {
+    var debugCond = super.getDebugCallback();
+    if (this._cpu.enableCodeCache)
+      this._cpu.enableCodeCache(this.canCacheCode(debugCond));
+    return debugCond;
+  }
+
   // TODO: refactor other parts into here
   runCPU(cpu, cycles:number) {
     this._cpu = cpu; // TODO?
     if (this.wasBreakpointHit())
       return 0;
     var debugCond = this.getDebugCallback();
+    var profiler = this.profiler;
+    var inst = this.instrumentation;
+    // PC breakpoints alone let the CPU run until it reaches one
+    var bps = this.breakpoints;
+    var runToPCs = debugCond && !profiler && !inst && bps.pcOnly && cpu.setBreakMap;
+    var journal = debugCond && !runToPCs ? this.journal : null;
     var targetTstates = cpu.getTstates() + cycles;
     try {
-      if (debugCond) { // || trace) {
+      if (runToPCs) {
+        // those instructions aren't journaled, so stepBack() must replay past them
+        if (this.journal) this.journal.forget();
+        cpu.setBreakMap(bps.pcmap);
+        while (cpu.getTstates() < targetTstates) {
+          if (debugCond()) {
+            debugCond = null;
+            break;
+          }
+          cpu.runFrame(targetTstates);
+        }
+      } else if (debugCond || profiler || inst) { // || trace) {
+        if (journal) journal.active = true;
         while (cpu.getTstates() < targetTstates) {
           if (debugCond && debugCond()) {
             debugCond = null;
             break;
           }
-          cpu.runFrame(cpu.getTstates() + 1);
+          if (journal) journal.logInstruction(cpu);
+          if (inst) inst.execute(cpu.getPC());
+          if (profiler) {
+            var T = cpu.getTstates();
+            var pc = cpu.getPC();
+            var sp = cpu.getSP();
+            cpu.runFrame(T + 1);
+            profiler.record(pc, sp, cpu.getTstates() - T);
+          } else {
+            cpu.runFrame(cpu.getTstates() + 1);
+          }
         }
       } else {
         cpu.runFrame(targetTstates);
@@ -553,12 +1167,38 @@ export abstract class BaseZ80Platform extends BaseDebugPlatform {
       console.log(e);
       this.breakpointHit(cpu.getTstates());
     }
+    if (runToPCs) cpu.setBreakMap(null);
+    if (journal) journal.active = false;
     return cpu.getTstates() - targetTstates;
   }
   requestInterrupt(cpu, data) {
     if (!this.wasBreakpointHit())
       cpu.requestInterrupt(data);
   }
+  // undo journal for stepBack(), and where each saved frame starts in it
+  journal : UndoJournal = null;
+  journalFrame = 0;
+  journalPrevFrame = -1;
+  debugPrevSavedState : EmuState = null;
+
+  restartDebugging() {
+    var fresh = !this.debugSavedState;
+    super.restartDebugging();
+    if (!this.probe) return;
+    if (!this.journal) {
+      this.journal = new UndoJournal((a) => { return this.readAddress(a); });
+      this.probe.journal(this.journal);
+    }
+    if (fresh) {
+      this.journal.reset();
+      this.journalFrame = 0;
+      this.journalPrevFrame = -1;
+      this.debugPrevSavedState = null;
+    } else {
+      // we replay from the saved frame, which logs it again
+      this.journal.truncate(this.journalFrame);
+    }
+  }
   postFrame() {
     if (this.debugCallback) {
       if (this.debugBreakState) {
@@ -566,9 +1206,13 @@ export abstract class BaseZ80Platform extends BaseDebugPlatform {
         this.loadState(this.debugBreakState);
       } else {
         // reset debug target clocks
+        this.debugPrevSavedState = this.debugSavedState;
+        this.journalPrevFrame = this.journalFrame;
+        this.journalFrame = this.journal ? this.journal.ninsns : 0;
         this.debugSavedState = this.saveState();
         if (this.debugTargetClock > 0)
           this.debugTargetClock -= this.debugSavedState.c.T;
+        this.breakpoints.rebaseClock(-this.debugSavedState.c.T);
         this.debugSavedState.c.T = 0;
         this.loadState(this.debugSavedState);
       }
@@ -583,21 +1227,33 @@ export abstract class BaseZ80Platform extends BaseDebugPlatform {
       this.onBreakpointHit(this.debugBreakState);
     }
   }
-  wasBreakpointHit() : boolean {
-    return this.debugBreakState != null;
-  }
   // TODO: lower bound of clock value
   step() {
     this.setDebugCondition( () => {
-      var cpuState = this.getCPUState();
-      if (cpuState.T > this.debugTargetClock) {
-        this.breakpointHit(cpuState.T);
+      var T = this._cpu.getTstates();
+      if (T > this.debugTargetClock) {
+        this.breakpointHit(T);
         return true;
       }
       return false;
-    });
+    }, {clock:this.debugTargetClock+1});
   }
   stepBack() {
+    // undo the last instruction from the journal, if we have it
+    var journal = this.journal;
+    var floor = this.debugPrevSavedState ? this.journalPrevFrame : this.journalFrame;
+    if (journal && this.debugBreakState && journal.canUndo(floor)) {
+      journal.undo((a,v) => { this.probe.bus.write(a,v); }, this._cpu);
+      if (journal.ninsns < this.journalFrame) {
+        // stepped back into the previous frame, so replay from there
+        this.debugSavedState = this.debugPrevSavedState;
+        this.journalFrame = this.journalPrevFrame;
+        this.debugPrevSavedState = null;
+        this.journalPrevFrame = -1;
+      }
+      this.breakpointHit(this._cpu.getTstates());
+      return;
+    }
     var prevState;
     var prevClock;
     this.setDebugCondition( () => {
@@ -624,7 +1280,17 @@ export abstract class BaseZ80Platform extends BaseDebugPlatform {
         }
       }
       return false;
-    });
+    }, {clock:this.debugTargetClock+1});
+  }
+  runToPC(pc : number) {
+    this.setDebugCondition( () => {
+      var T = this._cpu.getTstates();
+      if (T > this.debugTargetClock && this._cpu.getPC() == pc) {
+        this.breakpointHit(T);
+        return true;
+      }
+      return false;
+    }, {pcs:[pc]});
   }
   runUntilReturn() {
     var depth = 1;
@@ -698,10 +1364,20 @@ export abstract class Base6809Platform extends BaseZ80Platform {
 
   newCPU(membus : MemoryBus) {
     var cpu = new CPU6809();
-    cpu.init(membus.write, membus.read, 0);
+    var probe = this.probe = new BusProbe(membus);
+    cpu.init(probe.write, probe.read, 0);
+    // the probe swaps its read/write when it starts or stops probing
+    probe.onchange = () => { cpu.setMemory(probe.write, probe.read); };
+    this._cpu = cpu;
     return cpu;
   }
 
+  // cached code fetches skip the probe, so don't cache while it's instrumenting
+  // or watching; the CPU still steps one instruction at a time, so breakpoints are fine
+  canCacheCode(debugCond : DebugCondition) : boolean {
+    return !this.instrumentation && !this.probeWatching;
+  }
+
   runUntilReturn() {
     var depth = 1;
     this.runEval((c:CpuState) => {
@@ -1132,7 +1808,7 @@ export abstract class BasicZ80ScanlinePlatform extends BaseZ80Platform {
       extraCycles = this.runCPU(this.cpu, this.cpuCyclesPerLine - extraCycles); // TODO: HALT opcode?
       this.drawScanline(sl);
     }
-    this.video.updateFrame();
+    if (!novideo) this.video.updateFrame();
   }
 
   loadROM(title, data) {
@@ -49,6 +49,15 @@ var IRQs;
 
 var byteTo, byteAt;
 
+// code bytes fetched from regions the platform marked as ROM,
+// so fetch() can skip the memory bus
+var codeCacheable = new Uint8Array(0x10000);
+var codeValid = new Uint8Array(0x10000);
+var codeBytes = new Uint8Array(0x10000);
+var codeCacheEnabled = true;
+// PCs where runFrame returns early, so breakpoints don't have to single-step
+var breakMap = null;
+
 var cycles = [
       6,0,0,6,6,0,6,6,6,6,6,0,6,6,3,6,          /* 00-0F */
       0,0,2,4,0,0,5,9,0,2,3,0,3,2,8,6,          /* 10-1F */
@@ -267,15 +276,24 @@ var signed16 = function(x) {
     return (x>32767)?(x-65536):x;
 };
 
+var fetchByte = function(addr) {
+    if (codeValid[addr]) return codeBytes[addr];
+    var v = byteAt(addr);
+    if (codeCacheable[addr] && codeCacheEnabled) {
+        codeBytes[addr] = v;
+        codeValid[addr] = 1;
+    }
+    return v;
+};
 var fetch = function() {
-    var v = byteAt(PC++);
+    var v = fetchByte(PC++);
     PC &= 0xffff;
     return v;
 };
 var fetch16 = function() {
-    var v1 = byteAt(PC++);
+    var v1 = fetchByte(PC++);
     PC &= 0xffff;
-    var v2 = byteAt(PC++);
+    var v2 = fetchByte(PC++);
     PC &= 0xffff;
     return v1*256+v2;
 };
@@ -1864,6 +1882,7 @@ var step = function() {
 };
 
 var reset = function(){
+    codeValid.fill(0);
     PC = ReadWord(vecRESET);
     DP = 0;
     CC |= F_FIRQMASK | F_IRQMASK;
@@ -2343,6 +2362,12 @@ var disasm = function(i,a,b,c,d,pc) {
     };
 
 
+var setMemory = function(bt,ba) {
+    // writes drop cached code, in case it's RAM
+    byteTo=function(a,v) { codeValid[a] = 0; bt(a,v); };
+    byteAt=ba;
+};
+
 //---------- Exports
 
 return {
@@ -2355,19 +2380,25 @@ return {
     runFrame: function(Tt){
         while (T<Tt){
           step();
+          if (breakMap !== null && breakMap[PC]) break;
         }
     },
+    setBreakMap: function(map) {
+      breakMap = map;
+    },
     T:function(){return T;},
     getTstates:function(){return T;},
     setTstates:function(t){T=t;},
     reset: reset,
     init: function(bt,ba,tck){
-        byteTo=bt;
-        byteAt=ba;
+        setMemory(bt,ba);
         ticks=tck;
         reset();
     },
+    // swap the bus functions, without a reset
+    setMemory: setMemory,
     getPC: function() { return PC; },
+    getSP: function() { return rS; },
     saveState: function() {
         return {
             PC:PC,
@@ -2382,7 +2413,31 @@ return {
             T:T
         };
     },
+    // mark [start,end] as ROM (or not) and drop its cached code,
+    // call again if the platform banks in different memory
+    setCodeCache: function(start, end, cacheable) {
+      codeCacheable.fill(cacheable ? 1 : 0, start, end+1);
+      codeValid.fill(0, start, end+1);
+    },
+    // cached fetches don't go through the bus, so debug probes won't see them
+    enableCodeCache: function(enabled) {
+      if (enabled != codeCacheEnabled) {
+        codeCacheEnabled = enabled;
+        codeValid.fill(0);
+      }
+    },
+    // the same state as a flat record of numbers at a[o..o+9]
+    saveRegs: function(a, o) {
+      a[o]=PC; a[o+1]=rS; a[o+2]=rU; a[o+3]=rA; a[o+4]=rB;
+      a[o+5]=rX; a[o+6]=rY; a[o+7]=DP; a[o+8]=CC; a[o+9]=T;
+    },
+    loadRegs: function(a, o) {
+      codeValid.fill(0);
+      PC=a[o]; rS=a[o+1]; rU=a[o+2]; rA=a[o+3]; rB=a[o+4];
+      rX=a[o+5]; rY=a[o+6]; DP=a[o+7]; CC=a[o+8]; T=a[o+9];
+    },
     loadState: function(s) {
+      codeValid.fill(0);
       PC=s.PC;
       rS=s.SP;
       rU=s.U;
@@ -125,6 +125,14 @@ memory.write(regPairs[11], regPairs[12] & 0xff);;
 			interruptible = true; /* unless overridden by opcode */
 			lastOpcodePrefix = opcodePrefix;
 			opcodePrefix = '';
+			if (codeCacheEnabled && !lastOpcodePrefix && codeCacheable[regPairs[12]]) {
+				var block = codeBlocks[regPairs[12]];
+				if (block === null) block = hotBlock(regPairs[12]);
+				if (block) {
+					block(frameLength);
+					continue;
+				}
+			}
 			switch (lastOpcodePrefix) {
 				case '':
 					tstates += ( 4);
@@ -15138,10 +15146,105 @@ memory.write(addr, regs[1]);;
 				default:
 					throw("Unknown opcode prefix: " + lastOpcodePrefix);
 			}
+			/* stop before an instruction the debugger wants to look at */
+			if (breakMap !== null && !opcodePrefix && breakMap[regPairs[12]]) break;
 		}
 		while (display.nextEventTime != null && display.nextEventTime <= tstates) display.doEvent();
 	};
 
+	/* Code cache: hot straight-line runs of unprefixed opcodes in regions the
+	platform has marked as cacheable (ROM) are translated into JS functions,
+	built from the same opcode bodies as the switch in runFrame. Each block
+	stops at anything that changes PC, sets a prefix or touches I/O, and returns
+	early at the end of the frame or when an interrupt is pending, so it runs
+	exactly the instructions the interpreter would have. */
+	var CODE_HOT_COUNT = 16;
+	var CODE_MAX_INSNS = 32;
+	var codeCacheEnabled = false;
+	var codeCacheable = new Uint8Array(0x10000);
+	var codeHits = new Uint8Array(0x10000);
+	var codeBlocks = [];
+	for (var i = 0; i < 0x10000; i++) codeBlocks.push(null); /* keep it a fast (non-sparse) array */
+	var codePrologue = null;
+	var codeSources, codeLengths, codeEndsBlock;
+	var codeBlocksCompiled = 0;
+
+	var parseOpcodeSources = function() {
+		var text = self.runFrame.toString();
+		text = text.substring(text.indexOf("case '':"), text.indexOf("case 'CB':"));
+		var sw = text.indexOf("switch (opcode)");
+		/* the generator changed shape, so say so rather than quietly running uncached */
+		if (sw < 0) throw new Error("Z80 code cache: no opcode switch in runFrame");
+		/* fetch prologue, minus the opcode read (the block already knows it) */
+		codePrologue = text.substring(text.indexOf(":") + 1, sw);
+		var rd = codePrologue.indexOf("opcode = ");
+		codePrologue = codePrologue.substring(0, rd) + codePrologue.substring(codePrologue.indexOf(";", rd) + 1);
+		codeSources = new Array(0x100);
+		codeLengths = new Uint8Array(0x100);
+		codeEndsBlock = new Uint8Array(0x100);
+		for (var i = 0; i < 0x100; i++) {
+			var start = text.indexOf("case " + i + ": { var fn" + i + " = function() {", sw);
+			var end = text.indexOf("}; fn" + i + "(); }", start);
+			if (start < 0 || end < 0) { codePrologue = null; throw new Error("Z80 code cache: no body for opcode " + i + " in runFrame"); }
+			var src = text.substring(text.indexOf("{", text.indexOf("function()", start)) + 1, end);
+			/* leave I/O, HALT and anything that can't be inlined to the interpreter */
+			if (/ioBus|halted|break|return|throw/.test(src)) continue;
+			codeSources[i] = src;
+			codeLengths[i] = src.split("regPairs[12]++").length;
+			codeEndsBlock[i] = /regPairs\[12\] *(=|\+=|-=|--)|opcodePrefix|interruptible/.test(src) ? 1 : 0;
+		}
+	};
+
+	var compileBlock = function(pc) {
+		"use strict"; /* keeps the eval'd code's variable lookups static */
+		if (!codePrologue) parseOpcodeSources();
+		var src = "";
+		var addr = pc;
+		for (var n = 0; n < CODE_MAX_INSNS && codeCacheable[addr]; n++) {
+			var op = memory.read(addr);
+			if (!codeSources[op]) break;
+			/* operands come from cacheable memory too, so fold them into constants */
+			var body = codeSources[op];
+			for (var k = 1; body.indexOf("memory.read(regPairs[12])") >= 0 && codeCacheable[(addr + k) & 0xffff]; k++)
+				body = body.replace("memory.read(regPairs[12])", memory.read((addr + k) & 0xffff));
+			if (n) src += "if (tstates >= frameLength || interruptPending) return;\n";
+			src += "{" + codePrologue + body + "}\n";
+			if (codeEndsBlock[op]) { n++; break; }
+			addr = (addr + codeLengths[op]) & 0xffff;
+		}
+		return n ? eval("(function(frameLength) {\n" + src + "})") : null;
+	};
+
+	var hotBlock = function(pc) {
+		if (++codeHits[pc] < CODE_HOT_COUNT) return null;
+		codeHits[pc] = 0;
+		var block = codeBlocks[pc] = compileBlock(pc) || false;
+		if (block) codeBlocksCompiled++;
+		return block;
+	};
+
+	/* mark [start,end] as (non-)cacheable; also drops any blocks that may cover it,
+	so call it again whenever the code there changes (e.g. a bank switch) */
+	self.setCodeCache = function(start, end, cacheable) {
+		for (var a = Math.max(0, start - CODE_MAX_INSNS*3); a <= end; a++) {
+			codeBlocks[a] = null;
+			codeHits[a] = 0;
+		}
+		codeCacheable.fill(cacheable ? 1 : 0, start, end + 1);
+	};
+	self.enableCodeCache = function(enabled) {
+		codeCacheEnabled = !!enabled;
+	};
+	self.getCodeBlocksCompiled = function() {
+		return codeBlocksCompiled;
+	};
+
+	/* PCs where runFrame returns early, so breakpoints don't have to single-step */
+	var breakMap = null;
+	self.setBreakMap = function(map) {
+		breakMap = map;
+	};
+
 	self.reset = function() {
 		regPairs[12] = regPairs[10] = 0;
 		iff1 = 0; iff2 = 0; im = 0; halted = false;
@@ -15195,6 +15298,29 @@ memory.write(addr, regs[1]);;
 		};
 	};
 
+	/* the same state as a flat record of numbers at a[o..o+19], so an undo
+	journal can keep one per instruction without allocating */
+	self.saveRegs = function(a, o) {
+		for (var i = 0; i < 13; i++) a[o+i] = regPairs[i];
+		a[o+13] = iff1;
+		a[o+14] = iff2;
+		a[o+15] = im;
+		a[o+16] = halted ? 1 : 0;
+		a[o+17] = tstates;
+		a[o+18] = interruptPending ? 1 : 0;
+		a[o+19] = interruptDataBus;
+	};
+	self.loadRegs = function(a, o) {
+		for (var i = 0; i < 13; i++) regPairs[i] = a[o+i];
+		iff1 = a[o+13];
+		iff2 = a[o+14];
+		im = a[o+15];
+		halted = !!a[o+16];
+		tstates = a[o+17];
+		interruptPending = !!a[o+18];
+		interruptDataBus = a[o+19];
+	};
+
 	/* Register / flag accessors (used for tape trapping and test harness) */
 	self.getAF = function() {
 		return regPairs[0];
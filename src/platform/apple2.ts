@@ -26,7 +26,14 @@ const GR_MIXMODE  = 2;
 const GR_PAGE1    = 4;
 const GR_HIRES    = 8;
 
-type AppleGRParams = {dirty:boolean[], grswitch:number, mem:number[]};
+// display rows that bus writes can dirty: 24 text/lores rows for each page,
+// then 192 hires lines for each page, then a dummy row for other addresses
+const ROW_TEXT = 0;
+const ROW_HIRES = ROW_TEXT + 24*2;
+const ROW_NONE = ROW_HIRES + 192*2;
+
+// dirty[rowmap[address]] counts the writes to each display row
+type AppleGRParams = {dirty:Uint32Array, rowmap:Uint16Array, grswitch:number, mem:number[]};
 
 const _Apple2Platform = function(mainElement) {
   const cpuFrequency = 1023000;
@@ -39,7 +46,8 @@ const _Apple2Platform = function(mainElement) {
   
   var cpu, ram, bus;
   var video, ap2disp, audio, timer;
-  var grdirty = new Array(0xc000 >> 7);
+  var grdirty = new Uint32Array(ROW_NONE+1);
+  var grrowmap = new Uint16Array(0xc000).fill(ROW_NONE);
   var grswitch = GR_TXMODE;
   var kbdlatch = 0;
   var soundstate = 0;
@@ -59,7 +67,6 @@ const _Apple2Platform = function(mainElement) {
     return APPLE2_PRESETS;
   }
   start() {
-    cpu = new jt.M6502();
     ram = new RAM(0x13000); // 64K + 16K LC RAM - 4K hardware
     // ROM
     var rom = new lzgmini().decode(APPLEIIGO_LZG);
@@ -131,8 +138,10 @@ const _Apple2Platform = function(mainElement) {
             // JMP VM_BASE
             case 0xc600: {
               // load program into RAM
-              if (pgmbin)
+              if (pgmbin) {
                 ram.mem.set(pgmbin.slice(HDR_SIZE), PGM_BASE);
+                ap2disp.invalidate(); // copied behind the dirty-row tracking
+              }
               return 0x4c;
             }
             case 0xc601: return VM_BASE&0xff;
@@ -147,7 +156,7 @@ const _Apple2Platform = function(mainElement) {
         val &= 0xff;
         if (address < 0xc000) {
           ram.mem[address] = val;
-          grdirty[address>>7] = 1;
+          grdirty[grrowmap[address]]++;
         } else if (address < 0xc100) {
           this.read(address); // strobe address, discard result
         } else if (address >= 0xd000 && !writeinhibit) {
@@ -158,7 +167,7 @@ const _Apple2Platform = function(mainElement) {
         }
       }
     };
-    cpu.connectBus(bus);
+    cpu = this.newCPU(bus);
     // create video/audio
     video = new RasterVideo(mainElement,280,192);
     audio = new SampleAudio(cpuFrequency);
@@ -189,7 +198,7 @@ const _Apple2Platform = function(mainElement) {
       }
     });
     var idata = video.getFrameData();
-    grparams = {dirty:grdirty, grswitch:grswitch, mem:ram.mem};
+    grparams = {dirty:grdirty, rowmap:grrowmap, grswitch:grswitch, mem:ram.mem};
     ap2disp = new Apple2Display(idata, grparams);
     timer = new AnimationTimer(60, this.nextFrame.bind(this));
   }
@@ -211,7 +220,6 @@ const _Apple2Platform = function(mainElement) {
       }
     }
     if (!novideo) {
-      grparams.dirty = grdirty;
       grparams.grswitch = grswitch;
       ap2disp.updateScreen();
       video.updateFrame();
@@ -254,6 +262,10 @@ const _Apple2Platform = function(mainElement) {
     this.unfixPC(state.c);
     cpu.loadState(state.c);
     this.fixPC(state.c);
+    // repaint only the rows the state changes
+    for (var a=0; a<0xc000; a++)
+      if (ram.mem[a] != state.b[a])
+        grdirty[grrowmap[a]]++;
     ram.mem.set(state.b);
     kbdlatch = state.kbd;
     grswitch = state.gr;
@@ -261,7 +273,6 @@ const _Apple2Platform = function(mainElement) {
     auxRAMbank = state.lc.b;
     writeinhibit = state.lc.w;
     setupLanguageCardConstants();
-    ap2disp.invalidate(); // repaint entire screen
   }
   saveState() {
     return {
@@ -358,14 +369,24 @@ const _Apple2Platform = function(mainElement) {
   return new Apple2Platform(); // return inner class from constructor
 };
 
-var Apple2Display = function(pixels : number[], apple : AppleGRParams) {
+var Apple2Display = function(pixels : Uint32Array, apple : AppleGRParams) {
   var XSIZE = 280;
   var YSIZE = 192;
   var PIXELON = 0xffffffff;
   var PIXELOFF = 0xff000000;
 
-  var oldgrmode = -1;
-  var textbuf = new Array(40*24);
+  const MODE_TEXT = 0;
+  const MODE_LORES = 1;
+  const MODE_HIRES = 2;
+
+  // Each mode and page (key = mode*2+page) renders into its own cache, so
+  // flipping pages or modes only copies rows. A row is redrawn when its
+  // write count (and flash phase, for text with flashing chars) changes.
+  var caches : Uint32Array[] = [];
+  var stamps : Int32Array[] = [];   // row stamp each cache line was drawn at
+  var flashrows : Uint8Array[] = [];
+  var shownKey = new Int8Array(YSIZE);
+  var shownStamp = new Int32Array(YSIZE);
 
   const flashInterval = 500;
 
@@ -409,7 +430,7 @@ var Apple2Display = function(pixels : number[], apple : AppleGRParams) {
      0x03d0, 0x07d0, 0x0bd0, 0x0fd0, 0x13d0, 0x17d0, 0x1bd0, 0x1fd0
   ];
 
-  var colors_lut;
+  var colors_lut : Uint32Array;
 
   /**
     * This function makes the color lookup table for hires mode.
@@ -419,7 +440,7 @@ var Apple2Display = function(pixels : number[], apple : AppleGRParams) {
     * for odd and even addresses (2) and each byte displays 7 pixels.
     */
   {
-     colors_lut = new Array(256*4*2*7);
+     colors_lut = new Uint32Array(256*4*2*7);
      var i,j;
      var c1,c2,c3 = 15;
      var base = 0;
@@ -474,37 +495,38 @@ var Apple2Display = function(pixels : number[], apple : AppleGRParams) {
      }
   }
 
-  function drawLoresChar(x, y, b)
+  // map each screen address to its display row
   {
-     var i,base,adr,c;
+     for (var page=0; page<2; page++)
+     {
+        for (var y=0; y<24; y++)
+           apple.rowmap.fill(ROW_TEXT + page*24 + y,
+              text_lut[y] + 0x400*(page+1), text_lut[y] + 0x400*(page+1) + 40);
+        for (var y=0; y<192; y++)
+           apple.rowmap.fill(ROW_HIRES + page*192 + y,
+              hires_lut[y] + 0x2000*(page+1), hires_lut[y] + 0x2000*(page+1) + 40);
+     }
+  }
+
+  function drawLoresChar(buf, x, y, b)
+  {
+     var i,base,c;
      base = (y<<3)*XSIZE + x*7; //(x<<2) + (x<<1) + x
      c = loresColor[b & 0x0f];
      for (i=0; i<4; i++)
      {
-        pixels[base] =
-        pixels[base+1] =
-        pixels[base+2] =
-        pixels[base+3] =
-        pixels[base+4] =
-        pixels[base+5] =
-        pixels[base+6] = c;
+        buf.fill(c, base, base+7);
         base += XSIZE;
      }
      c = loresColor[b >> 4];
      for (i=0; i<4; i++)
      {
-        pixels[base] =
-        pixels[base+1] =
-        pixels[base+2] =
-        pixels[base+3] =
-        pixels[base+4] =
-        pixels[base+5] =
-        pixels[base+6] = c;
+        buf.fill(c, base, base+7);
         base += XSIZE;
      }
   }
 
-  function drawTextChar(x, y, b, invert)
+  function drawTextChar(buf, x, y, b, invert)
   {
      var base = (y<<3)*XSIZE + x*7; // (x<<2) + (x<<1) + x
      var on,off;
@@ -521,75 +543,61 @@ var Apple2Display = function(pixels : number[], apple : AppleGRParams) {
      for (var yy=0; yy<8; yy++)
      {
         var chr = apple2_charset[(b<<3)+yy];
-        pixels[base] = ((chr & 64) > 0)?on:off;
-        pixels[base+1] = ((chr & 32) > 0)?on:off;
-        pixels[base+2] = ((chr & 16) > 0)?on:off;
-        pixels[base+3] = ((chr & 8) > 0)?on:off;
-        pixels[base+4] = ((chr & 4) > 0)?on:off;
-        pixels[base+5] = ((chr & 2) > 0)?on:off;
-        pixels[base+6] = ((chr & 1) > 0)?on:off;
+        buf[base] = ((chr & 64) > 0)?on:off;
+        buf[base+1] = ((chr & 32) > 0)?on:off;
+        buf[base+2] = ((chr & 16) > 0)?on:off;
+        buf[base+3] = ((chr & 8) > 0)?on:off;
+        buf[base+4] = ((chr & 4) > 0)?on:off;
+        buf[base+5] = ((chr & 2) > 0)?on:off;
+        buf[base+6] = ((chr & 1) > 0)?on:off;
         base += XSIZE;
      }
   }
 
-  function drawHiresLines(y, maxy)
+  function drawHiresLine(buf, y, base)
   {
      var yb = y*XSIZE;
-     for (; y < maxy; y++)
+     var mem = apple.mem;
+     var b = 0;
+     var b1 = mem[base] & 0xff;
+     for (var x1=0; x1<20; x1++)
      {
-        var base = hires_lut[y] + (((apple.grswitch & GR_PAGE1) != 0) ? 0x4000 : 0x2000);
-        if (!apple.dirty[base >> 7])
-        {
-           yb += XSIZE;
-           continue;
-        }
-        var c1, c2;
-        var b = 0;
-        var b1 = apple.mem[base] & 0xff;
-        for (var x1=0; x1<20; x1++)
-        {
-           var b2 = apple.mem[base+1] & 0xff;
-           var b3 = apple.mem[base+2] & 0xff;
-           var d1 = (((b&0x40)<<2) | b1 | b2<<9) & 0x3ff;
-           for (var i=0; i<7; i++)
-              pixels[yb+i] = colors_lut[d1*7+i];
-           var d2 = (((b1&0x40)<<2) | b2 | b3<<9) & 0x3ff;
-           for (var i=0; i<7; i++)
-              pixels[yb+7+i] = colors_lut[d2*7+7168+i];
-           yb += 14;
-           base += 2;
-           b = b2;
-           b1 = b3;
-        }
+        var b2 = mem[base+1] & 0xff;
+        var b3 = (x1 < 19) ? mem[base+2] & 0xff : 0; // nothing right of the line
+        // 7 pixels each from (prev byte bit 6, byte, next byte bit 0)
+        var d1 = ((((b&0x40)<<2) | b1 | b2<<9) & 0x3ff) * 7;
+        buf[yb]   = colors_lut[d1];
+        buf[yb+1] = colors_lut[d1+1];
+        buf[yb+2] = colors_lut[d1+2];
+        buf[yb+3] = colors_lut[d1+3];
+        buf[yb+4] = colors_lut[d1+4];
+        buf[yb+5] = colors_lut[d1+5];
+        buf[yb+6] = colors_lut[d1+6];
+        var d2 = ((((b1&0x40)<<2) | b2 | b3<<9) & 0x3ff) * 7 + 7168;
+        buf[yb+7]  = colors_lut[d2];
+        buf[yb+8]  = colors_lut[d2+1];
+        buf[yb+9]  = colors_lut[d2+2];
+        buf[yb+10] = colors_lut[d2+3];
+        buf[yb+11] = colors_lut[d2+4];
+        buf[yb+12] = colors_lut[d2+5];
+        buf[yb+13] = colors_lut[d2+6];
+        yb += 14;
+        base += 2;
+        b = b2;
+        b1 = b3;
      }
   }
 
-  function drawLoresLine(y)
+  function drawLoresRow(buf, y, base)
   {
-     // get the base address of this line
-     var base = text_lut[y] +
-                (((apple.grswitch & GR_PAGE1) != 0) ? 0x800 : 0x400);
-  //		if (!dirty[base >> 7])
-  //		    return;
      for (var x=0; x<40; x++)
-     {
-        var b = apple.mem[base+x] & 0xff;
-        // if the char. changed, draw it
-        if (b != textbuf[y*40+x])
-        {
-           drawLoresChar(x, y, b);
-           textbuf[y*40+x] = b;
-        }
-     }
+        drawLoresChar(buf, x, y, apple.mem[base+x] & 0xff);
   }
 
-  function drawTextLine(y, flash)
+  // returns true if the row has flashing chars
+  function drawTextRow(buf, y, base, flash)
   {
-     // get the base address of this line
-     var base = text_lut[y] +
-                (((apple.grswitch & GR_PAGE1) != 0) ? 0x800 : 0x400);
-  //		if (!dirty[base >> 7])
-  //		    return;
+     var flashing = false;
      for (var x=0; x<40; x++)
      {
         var b = apple.mem[base+x] & 0xff;
@@ -598,82 +606,104 @@ var Apple2Display = function(pixels : number[], apple : AppleGRParams) {
         if (b >= 0x80)
         {
            invert = false;
+           b &= 0x7f;
         } else if (b >= 0x40)
         {
            invert = flash;
-           if (flash)
-              b -= 0x40;
-           else
-              b += 0x40;
+           flashing = true;
+           b &= 0x3f;
         } else
            invert = true;
-        // if the char. changed, draw it
-        if (b != textbuf[y*40+x])
-        {
-           drawTextChar(x, y, b & 0x7f, invert);
-           textbuf[y*40+x] = b;
-        }
+        drawTextChar(buf, x, y, b, invert);
      }
+     return flashing;
   }
 
-  this.updateScreen = function(totalrepaint)
+  function getCache(key)
   {
-     var y;
-     var flash = (new Date().getTime() % (flashInterval<<1)) > flashInterval;
+     if (!caches[key])
+     {
+        caches[key] = new Uint32Array(XSIZE*YSIZE);
+        stamps[key] = new Int32Array(YSIZE).fill(-1);
+        flashrows[key] = new Uint8Array(24);
+     }
+     return caches[key];
+  }
 
-     // if graphics mode changed, repaint whole screen
-     if (apple.grswitch != oldgrmode)
+  // copy cache lines to the screen unless they're already there
+  function present(key, cache, y, nlines, stamp)
+  {
+     if (shownKey[y] == key && shownStamp[y] == stamp)
+        return;
+     pixels.set(cache.subarray(y*XSIZE, (y+nlines)*XSIZE), y*XSIZE);
+     for (var i=y; i<y+nlines; i++)
      {
-        oldgrmode = apple.grswitch;
-        totalrepaint = true;
+        shownKey[i] = key;
+        shownStamp[i] = stamp;
      }
-     if (totalrepaint)
+  }
+
+  function updateRows(mode, page, row, maxrow, flash)
+  {
+     var key = mode*2 + page;
+     var cache = getCache(key);
+     var drawn = stamps[key];
+     if (mode == MODE_HIRES)
      {
-        // clear textbuf if in text mode
-        if ((apple.grswitch & GR_TXMODE) != 0 || (apple.grswitch & GR_MIXMODE) != 0)
+        for (var y=row*8; y<maxrow*8; y++)
         {
-           for (y=0; y<24; y++)
-              for (var x=0; x<40; x++)
-                 textbuf[y*40+x] = -1;
+           var stamp = apple.dirty[ROW_HIRES + page*192 + y] << 1;
+           if (drawn[y] != stamp)
+           {
+              drawHiresLine(cache, y, hires_lut[y] + (page ? 0x4000 : 0x2000));
+              drawn[y] = stamp;
+           }
+           present(key, cache, y, 1, stamp);
         }
-        for (var i=0; i<apple.dirty.length; i++)
-           apple.dirty[i] = true;
+        return;
      }
-
-     // first, draw top part of window
-     if ((apple.grswitch & GR_TXMODE) != 0)
-     {
-        for (y=0; y<20; y++)
-           drawTextLine(y, flash);
-     } else
+     for (; row<maxrow; row++)
      {
-        if ((apple.grswitch & GR_HIRES) != 0)
-           drawHiresLines(0, 160);
-        else
-           for (y=0; y<20; y++)
-              drawLoresLine(y);
+        var gen = apple.dirty[ROW_TEXT + page*24 + row] << 1;
+        var stamp = gen | (flashrows[key][row] ? flash : 0);
+        if (drawn[row*8] != stamp)
+        {
+           var base = text_lut[row] + (page ? 0x800 : 0x400);
+           if (mode == MODE_TEXT)
+              flashrows[key][row] = drawTextRow(cache, row, base, flash != 0) ? 1 : 0;
+           else
+              drawLoresRow(cache, row, base);
+           stamp = drawn[row*8] = gen | (flashrows[key][row] ? flash : 0);
+        }
+        present(key, cache, row*8, 8, stamp);
      }
+  }
+
+  this.updateScreen = function(totalrepaint)
+  {
+     var flash = (new Date().getTime() % (flashInterval<<1)) > flashInterval ? 1 : 0;
+     var page = (apple.grswitch & GR_PAGE1) ? 1 : 0;
+     var mode = (apple.grswitch & GR_TXMODE) ? MODE_TEXT
+              : (apple.grswitch & GR_HIRES) ? MODE_HIRES : MODE_LORES;
+
+     if (totalrepaint)
+        this.invalidate();
 
+     // first, draw top part of window
+     updateRows(mode, page, 0, 20, flash);
      // now do mixed part of window
-     if ((apple.grswitch & GR_TXMODE) != 0 || (apple.grswitch & GR_MIXMODE) != 0)
-     {
-        for (y=20; y<24; y++)
-           drawTextLine(y, flash);
-     } else
-     {
-        if ((apple.grswitch & GR_HIRES) != 0)
-           drawHiresLines(160, 192);
-        else
-           for (y=20; y<24; y++)
-              drawLoresLine(y);
-     }
-     for (var i=0; i<apple.dirty.length; i++)
-        apple.dirty[i] = false;
+     if ((apple.grswitch & GR_MIXMODE) != 0)
+        mode = MODE_TEXT;
+     updateRows(mode, page, 20, 24, flash);
   }
   
   this.invalidate = function() {
-    oldgrmode = -1;
+    for (var key=0; key<stamps.length; key++)
+      if (stamps[key])
+        stamps[key].fill(-1);
+    shownKey.fill(-1);
   }
+  this.invalidate();
 }
 
 /*exported apple2_charset */
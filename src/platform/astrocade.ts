@@ -1,6 +1,7 @@
 "use strict";
 
 import { Platform, BaseZ80Platform  } from "../baseplatform";
+import { CodeAnalyzer_z80 } from "../analysis";
 import { PLATFORMS, RAM, newAddressDecoder, padBytes, noise, setKeyboardFromMap, AnimationTimer, RasterVideo, Keys, makeKeycodeMap } from "../emu";
 import { hex, lzgmini, stringToByteArray, rgb2bgr, clamp } from "../util";
 import { MasterAudio, AY38910_Audio } from "../audio";
@@ -58,6 +59,31 @@ const ASTROCADE_KEYCODE_MAP = makeKeycodeMap([
   [Keys.VK_E,			0x17, 0x20],
 ]);
 
+// magic register tables
+const MAGIC_FLOP = new Uint8Array(256);      // reverse the 4 pixels of a byte
+const MAGIC_COLLIDE = new Uint8Array(256);   // 0x55 mask of pixels turned on -> intercept bits
+// palette index of the 4 pixels of each byte, right of horcb (0-1023) and left of it (1024-2047)
+const PIXEL_INDEX = new Uint8Array(2048);
+for (var i=0; i<2048; i++) {
+  PIXEL_INDEX[i] = ((i & 1024) ? 4 : 0) + ((i >> ((3 - (i&3))*2 + 2)) & 3);
+}
+for (var i=0; i<256; i++) {
+  var v = i;
+  var v2 = 0;
+  for (var j=0; j<4; j++) {
+    v2 |= (v & 3) << (6-j*2);
+    v >>= 2;
+  }
+  MAGIC_FLOP[i] = v2;
+  var icpt = 0;
+  for (var j=0; j<8; j+=2) {
+    icpt <<= 1;
+    if ((i>>j) & 1)
+      icpt |= 1;
+  }
+  MAGIC_COLLIDE[i] = icpt;
+}
+
 const _BallyAstrocadePlatform = function(mainElement, arcade) {
 
   var cpu, ram, membus, iobus, rom, bios;
@@ -88,23 +114,80 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
   // default palette
   for (var i=0; i<8; i++)
     palette[i] = ASTROCADE_PALETTE[i];
+  // expanded bytes for the upper (0-255) and lower (256-511) nibble, per xpand
+  var expandTable = new Uint8Array(512);
+  // The screen is kept as palette indices, and each line is colored from
+  // them when the beam reaches it, unless it already has the current
+  // palette. Palettes are numbered by content, so games that switch
+  // between the same palettes (or rewrite the same colors) don't redraw.
+  var indexbuf = new Uint8Array(swidth*sheight);
+  var lineIds = new Int32Array(sheight).fill(-1); // palette each line was colored with
+  var paletteIds = {};
+  var numPaletteIds = 0;
+  var nextPaletteId = 0;
+  var paletteId = 0;
 
   var refreshlines = 0;
 
+  function updateExpandTable() {
+    for (var i=0; i<512; i++) {
+      var v = (i & 0x100) ? i : i >> 4;
+      var v2 = 0;
+      for (var j=0; j<4; j++) {
+        var pix = (v&1) ? ((xpand>>2)&3) : (xpand&3);
+        v2 |= pix << (j*2);
+        v >>= 1;
+      }
+      expandTable[i] = v2;
+    }
+  }
+
+  function updatePaletteId() {
+    var key = palette.join();
+    var id = paletteIds[key];
+    if (id === undefined) {
+      if (++numPaletteIds > 64) {
+        paletteIds = {};
+        numPaletteIds = 1;
+      }
+      id = paletteIds[key] = nextPaletteId++;
+    }
+    paletteId = id;
+  }
+  updateExpandTable();
+  updatePaletteId();
+
   function ramwrite(a:number, v:number) {
     ram.mem[a] = v;
     ramupdate(a, v);
   }
 
   function ramupdate(a:number, v:number) {
-    var ofs = a*4+3; // 4 pixels per byte
-    for (var i=0; i<4; i++) {
-      var lr = ((a % swbytes) >= (horcb & 0x3f)) ? 0 : 4;
-      pixels[ofs--] = palette[lr + (v & 3)];
-      v >>= 2;
+    var ofs = a*4; // 4 pixels per byte
+    var x = a % swbytes;
+    var i = (v << 2) | ((x >= (horcb & 0x3f)) ? 0 : 1024);
+    indexbuf[ofs] = PIXEL_INDEX[i];
+    indexbuf[ofs+1] = PIXEL_INDEX[i+1];
+    indexbuf[ofs+2] = PIXEL_INDEX[i+2];
+    indexbuf[ofs+3] = PIXEL_INDEX[i+3];
+    var y = (a - x) / swbytes;
+    if (lineIds[y] == paletteId) {
+      pixels[ofs] = palette[PIXEL_INDEX[i]];
+      pixels[ofs+1] = palette[PIXEL_INDEX[i+1]];
+      pixels[ofs+2] = palette[PIXEL_INDEX[i+2]];
+      pixels[ofs+3] = palette[PIXEL_INDEX[i+3]];
+    } else if (y < sheight) {
+      lineIds[y] = -1; // color it when the beam gets there
     }
   }
 
+  function colorline(y:number) {
+    var ofs = y*swidth;
+    for (var i=0; i<swidth; i++)
+      pixels[ofs+i] = palette[indexbuf[ofs+i]];
+    lineIds[y] = paletteId;
+  }
+
   function refreshline(y:number) {
     var ofs = y*swidth/4;
     for (var i=0; i<swidth/4; i++)
@@ -114,15 +197,7 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
   function magicwrite(a:number, v:number) {
     // expand
     if (magicop & 0x8) {
-      var v2 = 0;
-      if (!xplower)
-        v >>= 4;
-      for (var i=0; i<4; i++) {
-        var pix = (v&1) ? ((xpand>>2)&3) : (xpand&3);
-        v2 |= pix << (i*2);
-        v >>= 1;
-      }
-      v = v2;
+      v = expandTable[xplower ? 0x100|v : v];
       xplower = !xplower;
     }
     // shift
@@ -132,12 +207,7 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
     v = v2;
     // flop
     if (magicop & 0x40) {
-      var v2 = 0;
-      for (var i=0; i<4; i++) {
-        v2 |= (v & 3) << (6-i*2);
-        v >>= 2;
-      }
-      v = v2;
+      v = MAGIC_FLOP[v];
     }
     // or/xor
     if (magicop & 0x30) {
@@ -146,14 +216,8 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
         v |= oldv;
       if (magicop & 0x20)
         v ^= oldv; // TODO: what if both?
-      // collision detect
-      var icpt = 0;
-      for (var i=0; i<8; i+=2) {
-        icpt <<= 1;
-        // pixel changed from off to on?
-        if ( !((oldv>>i)&3) && ((v>>i)&3) )
-          icpt |= 1;
-      }
+      // collision detect: pixels that changed from off to on
+      var icpt = MAGIC_COLLIDE[(v | (v>>1)) & ~(oldv | (oldv>>1)) & 0x55];
       // upper 4 bits persist, lower are just since last write
       inputs[8] = (inputs[8] & 0xf0) | icpt | (icpt<<4);
     }
@@ -162,8 +226,11 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
   }
 
   function setpalette(a:number, v:number) {
-    palette[a&7] = ASTROCADE_PALETTE[v&0xff];
-    refreshall();
+    var col = ASTROCADE_PALETTE[v&0xff];
+    if (palette[a&7] != col) {
+      palette[a&7] = col;
+      updatePaletteId();
+    }
   }
 
   function setbordercolor() {
@@ -278,6 +345,7 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
           case 0x19: // XPAND
             xpand = val;
             xplower = false;
+            updateExpandTable();
             break;
           default:
             console.log('IO write', hex(addr,4), hex(val,2));
@@ -318,6 +386,9 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
         refreshline(sl);
         refreshlines--;
       }
+      if (lineIds[sl] != paletteId) {
+        colorline(sl);
+      }
     }
     if (!novideo) {
       video.updateFrame(0, 0, 0, 0, swidth, verbl);
@@ -342,10 +413,12 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
 
   loadState(state) {
     cpu.loadState(state.c); // TODO: this causes problems on reset+debug
-    ram.mem.set(state.b);
+    var border = horcb != state.horcb;
     palette.set(state.palette);
     magicop = state.magicop;
     xpand = state.xpand;
+    updateExpandTable();
+    updatePaletteId();
     xplower = state.xplower;
     shift2 = state.shift2;
     horcb = state.horcb;
@@ -353,8 +426,16 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
     inlin = state.inlin;
     infbk = state.infbk;
     verbl = state.verbl;
+    // update only the screen bytes the state changes, unless the border moved
+    if (border) {
+      refreshall();
+    } else {
+      for (var a=0; a<swbytes*sheight; a++)
+        if (ram.mem[a] != state.b[a])
+          ramupdate(a, state.b[a]);
+    }
+    ram.mem.set(state.b);
     this.loadControlsState(state);
-    refreshall();
   }
   saveState() {
     return {
@@ -384,6 +465,9 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
   getCPUState() {
     return cpu.saveState();
   }
+  newCodeAnalyzer() {
+    return new CodeAnalyzer_z80(this, cpuCyclesPerLine);
+  }
 
   isRunning() {
     return timer && timer.isRunning();
@@ -399,6 +483,8 @@ const _BallyAstrocadePlatform = function(mainElement, arcade) {
   reset() {
     cpu.reset();
     cpu.setTstates(0);
+    cpu.setCodeCache(0x0000, 0x3fff, true);
+    if (arcade) cpu.setCodeCache(0x8000, 0xafff, true);
     //watchdog_counter = INITIAL_WATCHDOG;
   }
  }
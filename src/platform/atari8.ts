@@ -37,6 +37,11 @@ function newPOKEYAudio() {
 const PF_LEFT  = [999,64,48,32];
 const PF_RIGHT = [999,192,208,224];
 
+// part of the frame that GTIA draws into the 352x192 video (2 pixels per color clock)
+const VISIBLE_TOP = 24;     // first line
+const VISIBLE_LEFT = 40;    // first color clock, 4-clock aligned
+const VISIBLE_WIDTH = 176;  // color clocks
+
 const DMACTL = 0;
 const CHACTL = 1;
 const DLISTL = 2;
@@ -310,6 +315,11 @@ class ANTIC {
           break;
       }
     }
+    this.nextPulse();
+    return nc;
+  }
+
+  nextPulse() {
     // next scanline?
     this.h += 4;
     if (this.h >= 228) {
@@ -319,7 +329,37 @@ class ANTIC {
         this.v = 0;
       }
     }
-    return nc;
+  }
+
+  // does clockPulse4() at (v,h) do any DMA or interrupt work?
+  isEventAt(v:number, h:number) : boolean {
+    if (v >= 240)
+      return v == 240 && (h == NMIST_CYCLE || h == NMI_CYCLE);
+    if (!(this.regs[DMACTL] & 0x20))
+      return false;
+    if (h == 0)
+      return true;
+    return h >= this.left && h < this.right && (this.mode & 0xf) >= 2 && ((h>>2) & this.period) == 0;
+  }
+
+  // count the pulses from here up to the next event (at most maxpulses),
+  // storing the running total of free CPU clocks after each one in ends[]
+  scanPulses(maxpulses:number, ends:Int32Array) : number {
+    let v = this.v;
+    let h = this.h;
+    let dma = (this.regs[DMACTL] & 0x20) != 0;
+    let clocks = 0;
+    let n = 0;
+    while (n < maxpulses && !this.isEventAt(v, h)) {
+      clocks += (dma && v < 240 && h >= 48 && h < 120) ? 3 : 4; // memory refresh
+      ends[n++] = clocks;
+      h += 4;
+      if (h >= 228) {
+        h = 0;
+        if (++v >= 262) v = 0;
+      }
+    }
+    return n;
   }
 }
 
@@ -352,13 +392,27 @@ const P0PL = 0xc;
 const TRIG0 = 0x10;
 const CONSOL = 0x1f;
 
-class GTIA {
+const GTIA_LOG_SIZE = 64;
+const LUT_4BPP = 6;
+const LUT_4BPP_PF3 = 10;
+
+export class GTIA {
   regs = new Uint8Array(0x20);
   count : number = 0;
   antic : ANTIC;
+  // playfield colors for drawSpan(): BK, PF0-PF3, text foreground,
+  // then the 4bpp palettes BK,PF0,PF1,PF2 and BK,PF0,PF1,PF3 (5th color)
+  lut = new Uint32Array(14);
+  // register writes not yet reached by drawing, in pulse order
+  logPulse = new Int32Array(GTIA_LOG_SIZE);
+  logReg = new Uint8Array(GTIA_LOG_SIZE);
+  logValue = new Uint8Array(GTIA_LOG_SIZE);
+  logLen : number = 0;
+  logPos : number = 0;
   
   constructor(antic : ANTIC) {
     this.antic = antic;
+    this.updateColors();
   }
   saveState() {
     return {
@@ -374,8 +428,48 @@ class GTIA {
   setReg(a:number, v:number) {
     this.regs[a] = v;
     switch (a) {
+      case COLPF0: case COLPF1: case COLPF2: case COLPF3: case COLBK:
+        this.updateColors();
+        break;
+    }
+  }
+  updateColors() {
+    let lut = this.lut;
+    lut[0] = COLORS_RGBA[this.regs[COLBK]];
+    for (let i=0; i<4; i++)
+      lut[i+1] = COLORS_RGBA[this.regs[COLPF0+i]];
+    lut[5] = COLORS_RGBA[(this.regs[COLPF1] & 0xf) | (this.regs[COLPF2] & 0xf0)];
+    for (let i=0; i<4; i++)
+      lut[LUT_4BPP+i] = lut[LUT_4BPP_PF3+i] = lut[i];
+    lut[LUT_4BPP_PF3+3] = lut[4];
+  }
+  // record a write that takes effect when drawing reaches the given pulse
+  // (returns false if the log is full)
+  logWrite(pulse:number, a:number, v:number) : boolean {
+    let n = this.logLen;
+    if (n >= GTIA_LOG_SIZE)
+      return false;
+    this.logPulse[n] = pulse;
+    this.logReg[n] = a;
+    this.logValue[n] = v;
+    this.logLen = n+1;
+    return true;
+  }
+  // apply the writes logged up to the given pulse,
+  // returning the pulse of the next one (or -1)
+  applyLog(pulse:number) : number {
+    let i = this.logPos;
+    while (i < this.logLen && this.logPulse[i] <= pulse) {
+      this.setReg(this.logReg[i], this.logValue[i]);
+      i++;
+    }
+    if (i < this.logLen) {
+      this.logPos = i;
+      return this.logPulse[i];
     }
-  }  
+    this.logPos = this.logLen = 0;
+    return -1;
+  }
   clockPulse() : number {
     let pixel = (this.antic.pfbyte & 128) ? 1 : 0;
     let col = 0;
@@ -420,6 +514,63 @@ class GTIA {
     this.count = (this.count + 1) & 0xff;
     return COLORS_RGBA[col];
   }
+  // same as n calls to clockPulse(), for a span where no registers change
+  drawSpan(idata:Uint32Array, ofs:number, n:number) : number {
+    let lut = this.lut;
+    let count = this.count;
+    let pfbyte = this.antic.pfbyte;
+    let period = this.antic.period;
+    let ch = this.antic.ch;
+    let end = ofs + n;
+    switch (this.antic.mode & 0xf) {
+      // blank line
+      case 0:
+      case 1:
+        idata.fill(lut[0], ofs, end);
+        count += n;
+        ofs = end;
+        break;
+      // normal text mode
+      case 2:
+      case 3:
+      default: {
+        let fg = lut[5];
+        let bg = lut[3];
+        for (; ofs < end; ofs++) {
+          idata[ofs] = (pfbyte & 128) ? fg : bg;
+          if ((count++ & period) == 0)
+            pfbyte <<= 1;
+        }
+        break;
+      }
+      // 4bpp mode
+      case 4:
+      case 5: {
+        let base = (ch & 0x80) ? LUT_4BPP_PF3 : LUT_4BPP; // 5th color
+        for (; ofs < end; ofs++) {
+          idata[ofs] = lut[base + ((pfbyte>>6) & 3)];
+          if ((count++ & 1) == 0)
+            pfbyte <<= 2;
+        }
+        break;
+      }
+      // 4 colors per 64 chars mode
+      case 6:
+      case 7: {
+        let fg = lut[1 + ((ch>>6) & 3)];
+        let bg = lut[0];
+        for (; ofs < end; ofs++) {
+          idata[ofs] = (pfbyte & 128) ? fg : bg;
+          if ((count++ & period) == 0)
+            pfbyte <<= 1;
+        }
+        break;
+      }
+    }
+    this.count = count & 0xff;
+    this.antic.pfbyte = pfbyte;
+    return ofs;
+  }
   static stateToLongString(state) : string {
     let s = "";
     s += dumpRAM(state.regs, 0, 32);
@@ -432,6 +583,8 @@ const _Atari8Platform = function(mainElement) {
   const cpuFrequency = 1789773;
   const linesPerFrame = 262;
   const colorClocksPerLine = 228;
+  const pulsesPerLine = colorClocksPerLine / 4;
+  const pulsesPerFrame = linesPerFrame * pulsesPerLine;
   // TODO: for 400/800/5200
   const romLength = 0x8000;
 
@@ -445,6 +598,73 @@ const _Atari8Platform = function(mainElement) {
   var antic : ANTIC;
   var gtia : GTIA;
   var inputs = new Uint8Array(4);
+
+  // The CPU runs in bursts of ANTIC pulses up to the next DMA or interrupt
+  // event, and GTIA draws the pulses it owes whenever ANTIC needs it to
+  // catch up. GTIA writes are logged with the pulse the CPU was in, and
+  // each span between them is drawn in one go. burstEnds[k] is the running total of free CPU
+  // clocks after pulse k of the burst.
+  var burstEnds = new Int32Array(pulsesPerFrame);
+  var burstLen = 0;     // pulses in the current burst
+  var burstLimit = 0;   // CPU clocks to run in the current burst
+  var burstBase = 0;    // free clocks carried into the burst (<= 0)
+  var burstClocks = 0;  // CPU clocks run so far in the burst
+  var burstPulse = 0;   // frame pulse the burst started at
+  var burstCursor = 0;  // last result of burstPulseAt()
+  var gtiaPulse = 0;    // frame pulses drawn by GTIA so far
+  var gtiaV = 0;
+  var gtiaH = 0;        // ANTIC position of the next pulse GTIA draws
+  var idata : Uint32Array;
+  var iofs = 0;
+
+  // which pulse of the burst is the CPU in? (clocks only go forward)
+  function burstPulseAt(clocks:number) : number {
+    var k = burstCursor;
+    while (k < burstLen-1 && burstBase + burstEnds[k] <= clocks)
+      k++;
+    return burstCursor = k;
+  }
+  // draw pixels up to (not including) the given frame pulse
+  function drawPulses(pulse:number) {
+    while (gtiaPulse < pulse) {
+      // draw up to the next logged write, the end of this line, or the given pulse
+      var next = gtia.applyLog(gtiaPulse);
+      var end = (next >= 0 && next < pulse) ? next : pulse;
+      var h1 = Math.min(colorClocksPerLine, gtiaH + (end - gtiaPulse) * 4);
+      // 4 ANTIC pulses = 8 pixels
+      if (gtiaV >= VISIBLE_TOP) {
+        var x0 = Math.max(gtiaH, VISIBLE_LEFT);
+        var x1 = Math.min(h1, VISIBLE_LEFT + VISIBLE_WIDTH);
+        if (x1 > x0)
+          iofs = gtia.drawSpan(idata, iofs, (x1 - x0) * 2);
+      }
+      gtiaPulse += (h1 - gtiaH) >> 2;
+      gtiaH = h1;
+      if (gtiaH >= colorClocksPerLine) {
+        gtiaH = 0;
+        if (++gtiaV >= linesPerFrame) gtiaV = 0;
+      }
+    }
+  }
+  // GTIA writes take effect from the pulse the CPU is in
+  function writeGTIA(a:number, v:number) {
+    if (burstLen) {
+      var pulse = burstPulse + burstPulseAt(burstClocks);
+      if (gtia.logWrite(pulse, a, v))
+        return;
+      // log is full, so catch up now
+      drawPulses(pulse);
+      gtia.applyLog(pulse);
+    }
+    gtia.setReg(a, v);
+  }
+  // ANTIC writes can change DMA, so cut the burst off after this pulse
+  function endBurst() {
+    if (burstLen) {
+      burstLen = burstPulseAt(burstClocks) + 1;
+      burstLimit = burstBase + burstEnds[burstLen-1];
+    }
+  }
   
  class Atari8Platform extends Base6502Platform implements Platform {
 
@@ -452,7 +672,6 @@ const _Atari8Platform = function(mainElement) {
     return Atari8_PRESETS;
   }
   start() {
-    cpu = new jt.M6502();
     ram = new RAM(0x4000); // TODO
     bios = new Uint8Array(0x800);
     bus = {
@@ -466,12 +685,12 @@ const _Atari8Platform = function(mainElement) {
       ]),
       write: newAddressDecoder([
         [0x0000, 0x3fff, 0xffff, function(a,v) { ram.mem[a] = v; }],
-        [0xc000, 0xcfff,   0x1f, function(a,v) { gtia.regs[a] = v; }],
-        [0xd400, 0xd4ff,    0xf, function(a,v) { antic.setReg(a,v); }],
+        [0xc000, 0xcfff,   0x1f, function(a,v) { writeGTIA(a,v); }],
+        [0xd400, 0xd4ff,    0xf, function(a,v) { endBurst(); antic.setReg(a,v); }],
         [0xe800, 0xefff,    0xf, function(a,v) { audio.pokey1.setRegister(a, v); }],
       ]),
     };
-    cpu.connectBus(bus);
+    cpu = this.newCPU(bus);
     // create support chips
     antic = new ANTIC(bus.read);
     gtia = new GTIA(antic);
@@ -498,44 +717,69 @@ const _Atari8Platform = function(mainElement) {
   }
   
   advance(novideo : boolean) {
-    var idata = video.getFrameData();
-    var iofs = 0;
+    idata = video.getFrameData();
+    iofs = 0;
     var debugCond = this.getDebugCallback();
-    var rgb;
     var freeClocks = 0;
     // load controls
     // TODO
     gtia.regs[0x10] = inputs[0] ^ 1;
-    // visible lines
-    for (var sl=0; sl<linesPerFrame; sl++) {
-      for (var i=0; i<colorClocksPerLine; i+=4) {
+    gtiaPulse = 0;
+    gtiaV = antic.v;
+    gtiaH = antic.h;
+    var pulse = 0;
+    while (pulse < pulsesPerFrame) {
+      burstPulse = pulse;
+      burstBase = freeClocks;
+      burstClocks = 0;
+      burstCursor = 0;
+      // step one pulse at a time while debugging, so conditions see the raster position
+      burstLen = antic.scanPulses(debugCond ? 1 : pulsesPerFrame - pulse, burstEnds);
+      var plain = burstLen > 0;
+      if (plain) {
+        antic.nextPulse(); // the rest are skipped after the burst
+      } else {
+        // ANTIC reads memory and sets pfbyte, so GTIA has to catch up first
+        drawPulses(pulse);
         // 2 color clocks per CPU cycle = 4 color clocks
-        freeClocks += antic.clockPulse4();
+        burstEnds[0] = antic.clockPulse4();
         // interrupt?
         if (antic.nmiPending) {
-          freeClocks -= cpu.setNMIAndWait(); // steal clocks b/c of interrupt (could be negative)
+          burstEnds[0] -= cpu.setNMIAndWait(); // steal clocks b/c of interrupt (could be negative)
           antic.nmiPending = false;
         }
-        // iterate CPU with free clocks
-        while (freeClocks > 0) {
-          freeClocks--;
-          if (debugCond && debugCond()) {
+        burstLen = 1;
+      }
+      // iterate CPU with free clocks (the burst can shrink on ANTIC writes)
+      burstLimit = burstBase + burstEnds[burstLen-1];
+      if (debugCond) {
+        while (burstClocks < burstLimit) {
+          if (debugCond()) {
             debugCond = null;
-            i = 999;
-            sl = 999;
+            endBurst();
+            pulse = pulsesPerFrame; // stop after this pulse
             break;
           }
           cpu.clockPulse();
+          burstClocks++;
         }
-        // 4 ANTIC pulses = 8 pixels
-        if (antic.v >= 24 && antic.h >= 44 && antic.h < 44+176) { // TODO: const
-          for (var j=0; j<8; j++) {
-            rgb = gtia.clockPulse();
-            idata[iofs++] = rgb;
-          }
+      } else {
+        while (burstClocks < burstLimit) {
+          cpu.clockPulse();
+          burstClocks++;
         }
       }
+      freeClocks = Math.min(0, burstLimit - burstClocks);
+      if (plain) {
+        for (var k=1; k<burstLen; k++)
+          antic.nextPulse();
+      }
+      if (pulse < pulsesPerFrame)
+        pulse = burstPulse + burstLen;
     }
+    drawPulses(burstPulse + burstLen);
+    gtia.applyLog(burstPulse + burstLen);
+    burstLen = 0;
     // update video frame
     if (!novideo) {
       video.updateFrame();
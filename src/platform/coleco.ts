@@ -1,6 +1,7 @@
 "use strict";
 
 import { Platform, BaseMAMEPlatform, BaseZ80Platform, getToolForFilename_z80 } from "../baseplatform";
+import { CodeAnalyzer_z80 } from "../analysis";
 import { PLATFORMS, RAM, newAddressDecoder, padBytes, noise, setKeyboardFromMap, AnimationTimer, RasterVideo, Keys, makeKeycodeMap } from "../emu";
 import { hex, lzgmini, stringToByteArray } from "../util";
 import { MasterAudio, SN76489_Audio } from "../audio";
@@ -151,7 +152,7 @@ const _ColecoVisionPlatform = function(mainElement) {
         this.runCPU(cpu, cpuCyclesPerLine);
         vdp.drawScanline(sl);
       }
-      video.updateFrame();
+      if (!novideo) video.updateFrame();
     }
 
     loadROM(title, data) {
@@ -186,6 +187,9 @@ const _ColecoVisionPlatform = function(mainElement) {
     getCPUState() {
       return cpu.saveState();
     }
+    newCodeAnalyzer() {
+      return new CodeAnalyzer_z80(this, cpuCyclesPerLine);
+    }
 
     isRunning() {
       return timer && timer.isRunning();
@@ -201,6 +205,8 @@ const _ColecoVisionPlatform = function(mainElement) {
     reset() {
       cpu.reset();
       cpu.setTstates(0);
+      cpu.setCodeCache(0x0000, 0x1fff, true); // BIOS
+      cpu.setCodeCache(0x8000, 0xffff, true); // cartridge
       vdp.reset();
       psg.reset();
     }
@@ -1,6 +1,7 @@
 "use strict";
 
 import { Platform, BaseZ80Platform  } from "../baseplatform";
+import { CodeAnalyzer_z80 } from "../analysis";
 import { PLATFORMS, RAM, newAddressDecoder, padBytes, noise, setKeyboardFromMap, AnimationTimer, RasterVideo, Keys, makeKeycodeMap } from "../emu";
 import { hex } from "../util";
 import { MasterAudio, AY38910_Audio } from "../audio";
@@ -50,6 +51,8 @@ const _GalaxianPlatform = function(mainElement, options) {
   var cpu;
   var ram, vram, oram : RAM;
   var membus, iobus, rom, palette, outlatches;
+  var tilePixels : Uint8Array;   // 2bpp color of each tile pixel, [tile][row][x]
+  var spritePixels : Uint8Array; // same for sprites, [flipx][code][row][x]
   var video, audio, timer, pixels;
   var psg1, psg2;
   var inputs;
@@ -71,6 +74,35 @@ const _GalaxianPlatform = function(mainElement, options) {
   for (var i=0; i<256; i++)
     stars[i] = noise();
 
+  // decode the 2bpp graphics ROM once, so scanlines only do lookups
+  function expandGraphics() {
+    tilePixels = new Uint8Array(0x800*8);
+    for (var ofs=0; ofs<0x800; ofs++) {
+      var data1 = rom[gfxBase+ofs];
+      var data2 = rom[gfxBase+ofs+0x800];
+      for (var i=0; i<8; i++) {
+        var bm = 128>>i;
+        tilePixels[(ofs<<3)+i] = ((data1&bm)?1:0) + ((data2&bm)?2:0);
+      }
+    }
+    // sprites are 16x16, made of 4 tiles; the second copy is flipped in x
+    spritePixels = new Uint8Array(2*64*16*16);
+    for (var code=0; code<64; code++) {
+      for (var yy=0; yy<16; yy++) {
+        var src = ((code<<5)+(yy<8?yy:yy+8))<<3;
+        var dest = ((code<<4)+yy)<<4;
+        for (var i=0; i<8; i++) {
+          var c1 = tilePixels[src+i];
+          var c2 = tilePixels[src+64+i];
+          spritePixels[dest+i] = c1;
+          spritePixels[dest+i+8] = c2;
+          spritePixels[0x4000+dest+15-i] = c1;
+          spritePixels[0x4000+dest+7-i] = c2;
+        }
+      }
+    }
+  }
+
 	function drawScanline(pixels, sl) {
     if (sl < 16 && !showOffscreenObjects) return; // offscreen
     if (sl >= 240 && !showOffscreenObjects) return; // offscreen
@@ -86,14 +118,9 @@ const _GalaxianPlatform = function(mainElement, options) {
       var yy = sl2 & 7; // y offset within tile
       var tile = vram.mem[vramofs+xofs]; // TODO: why undefined?
 			var color0 = (attrib & 7) << 2;
-      var addr = gfxBase+(tile<<3)+yy;
-			var data1 = rom[addr];
-      var data2 = rom[addr+0x800];
+      var src = ((tile<<3)+yy)<<3;
       for (var i=0; i<8; i++) {
-        var bm = 128>>i;
-        var color = color0 + ((data1&bm)?1:0) + ((data2&bm)?2:0);
-        pixels[outi] = palette[color];
-        outi++;
+        pixels[outi++] = palette[color0 + tilePixels[src++]];
       }
 		}
     // draw sprites
@@ -107,28 +134,16 @@ const _GalaxianPlatform = function(mainElement, options) {
         if (sx == 0 && !showOffscreenObjects)
           continue; // drawn off-buffer
         var code = oram.mem[base+1];
-        var flipx = code & 0x40; // TODO: flipx
         if (code & 0x80) // flipy
           yy = 15-yy;
-        code &= 0x3f;
         var color0 = (oram.mem[base+2] & 7) << 2;
-        var addr = gfxBase+(code<<5)+(yy<8?yy:yy+8);
+        // code bit 6 = flipx, picks the mirrored copy
+        var src = (((code & 0x7f)<<4)+yy)<<4;
         outi = pixofs + sx; //<< 1
-        var data1 = rom[addr];
-        var data2 = rom[addr+0x800];
-  			for (var i=0; i<8; i++) {
-          var bm = 128>>i;
-          var color = ((data1&bm)?1:0) + ((data2&bm)?2:0);
+  			for (var i=0; i<16; i++) {
+          var color = spritePixels[src+i];
           if (color)
-  				    pixels[flipx?(outi+15-i):(outi+i)] = palette[color0 + color];
-        }
-        var data1 = rom[addr+8];
-        var data2 = rom[addr+0x808];
-  			for (var i=0; i<8; i++) {
-          var bm = 128>>i;
-          var color = ((data1&bm)?1:0) + ((data2&bm)?2:0);
-          if (color)
-              pixels[flipx?(outi+7-i):(outi+i+8)] = palette[color0 + color];
+  				    pixels[outi+i] = palette[color0 + color];
         }
       }
     }
@@ -325,6 +340,7 @@ const _GalaxianPlatform = function(mainElement, options) {
 
   loadROM(title, data) {
     rom = padBytes(data, romSize);
+    expandGraphics();
 
 		palette = new Uint32Array(new ArrayBuffer(32*4));
 		for (var i=0; i<32; i++) {
@@ -380,6 +396,9 @@ const _GalaxianPlatform = function(mainElement, options) {
   getCPUState() {
     return cpu.saveState();
   }
+  newCodeAnalyzer() {
+    return new CodeAnalyzer_z80(this, cpuCyclesPerLine);
+  }
 
   isRunning() {
     return timer && timer.isRunning();
@@ -394,6 +413,7 @@ const _GalaxianPlatform = function(mainElement, options) {
   }
   reset() {
     cpu.reset();
+    cpu.setCodeCache(0x0000, 0x3fff, true);
 		//audio.reset();
     if (!this.getDebugCallback()) cpu.setTstates(0); // TODO?
     watchdog_counter = INITIAL_WATCHDOG;
@@ -1,6 +1,7 @@
 "use strict";
 
 import { Platform, BaseZ80Platform  } from "../baseplatform";
+import { CodeAnalyzer_z80 } from "../analysis";
 import { PLATFORMS, RAM, newAddressDecoder, padBytes, noise, setKeyboardFromMap, AnimationTimer, RasterVideo, Keys, makeKeycodeMap } from "../emu";
 import { hex } from "../util";
 
@@ -16,7 +17,7 @@ const _Midway8080BWPlatform = function(mainElement) {
 
   var cpu, ram, membus, iobus, rom;
   var probe;
-  var video, timer, pixels, displayPCs;
+  var video, timer, pixels;
   var inputs = [0xe,0x8,0x0];
   var bitshift_offset = 0;
   var bitshift_register = 0;
@@ -27,6 +28,12 @@ const _Midway8080BWPlatform = function(mainElement) {
   const PIXEL_ON = 0xffeeeeee;
   const PIXEL_OFF = 0xff000000;
 
+  function drawVRAMByte(a, v) {
+    var ofs = (a - 0x400)<<3;
+    for (var i=0; i<8; i++)
+      pixels[ofs+i] = (v & (1<<i)) ? PIXEL_ON : PIXEL_OFF;
+  }
+
 	const SPACEINV_KEYCODE_MAP = makeKeycodeMap([
 		[Keys.VK_SPACE, 1, 0x10], // P1
 		[Keys.VK_LEFT, 1, 0x20],
@@ -46,8 +53,8 @@ const _Midway8080BWPlatform = function(mainElement) {
   }
 
   start = function() {
+    var self = this;
     ram = new RAM(0x2000);
-    //displayPCs = new Uint16Array(new ArrayBuffer(0x2000*2));
     membus = {
       read: newAddressDecoder([
 				[0x0000, 0x1fff, 0x1fff, function(a) { return rom ? rom[a] : 0; }],
@@ -57,10 +64,7 @@ const _Midway8080BWPlatform = function(mainElement) {
 				[0x2000, 0x23ff, 0x3ff,  function(a,v) { ram.mem[a] = v; }],
 				[0x2400, 0x3fff, 0x1fff, function(a,v) {
 					ram.mem[a] = v;
-					var ofs = (a - 0x400)<<3;
-					for (var i=0; i<8; i++)
-						pixels[ofs+i] = (v & (1<<i)) ? PIXEL_ON : PIXEL_OFF;
-          if (displayPCs) displayPCs[a] = cpu.getPC(); // save program counter
+					drawVRAMByte(a, v);
 				}],
 			]),
       isContended: function() { return false; },
@@ -107,7 +111,7 @@ const _Midway8080BWPlatform = function(mainElement) {
 			var x = Math.floor(e.offsetX * video.canvas.width / $(video.canvas).width());
 			var y = Math.floor(e.offsetY * video.canvas.height / $(video.canvas).height());
 			var addr = (x>>3) + (y*32) + 0x400;
-      if (displayPCs) console.log(x, y, hex(addr,4), "PC", hex(displayPCs[addr],4));
+      if (self.instrumentation) console.log(x, y, hex(addr,4), "PC", hex(self.instrumentation.lastWriterPC[addr],4));
 		});
     var idata = video.getFrameData();
 		setKeyboardFromMap(video, inputs, SPACEINV_KEYCODE_MAP);
@@ -143,6 +147,10 @@ const _Midway8080BWPlatform = function(mainElement) {
 
   loadState(state) {
     cpu.loadState(state.c);
+    // pixels are drawn at write time, so repaint the bytes the state changes
+    for (var a=0x400; a<0x2000; a++)
+      if (ram.mem[a] != state.b[a])
+        drawVRAMByte(a, state.b[a]);
     ram.mem.set(state.b);
     bitshift_register = state.bsr;
     bitshift_offset = state.bso;
@@ -178,6 +186,9 @@ const _Midway8080BWPlatform = function(mainElement) {
   getCPUState() {
     return cpu.saveState();
   }
+  newCodeAnalyzer() {
+    return new CodeAnalyzer_z80(this, cpuCyclesPerLine);
+  }
 
   isRunning() {
     return timer && timer.isRunning();
@@ -191,6 +202,7 @@ const _Midway8080BWPlatform = function(mainElement) {
   reset() {
     cpu.reset();
     cpu.setTstates(0);
+    cpu.setCodeCache(0x0000, 0x1fff, true);
     watchdog_counter = INITIAL_WATCHDOG;
   }
  }
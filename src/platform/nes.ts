@@ -72,7 +72,24 @@ class JSNESPlatform extends Base6502Platform implements Platform {
   audioFrequency = 44030; //44100
   frameindex = 0;
   ntvideo;
-  ntlastbuf;
+  ptvideo;
+  oamvideo;
+  ntvisible = false;
+  ptvisible = false;
+  oamvisible = false;
+  // PPU write tracking for the debug views
+  ntdirty = new Uint8Array(0x1000); // nametable/attribute bytes, by physical address
+  ptdirty = new Uint8Array(512);    // pattern tiles
+  ptlast = new Array(512);          // Tile objects last drawn (bank switches swap them)
+  vramChanged = false;
+  debugFull = true;
+  lastPalette = new Int32Array(32);
+  lastBaseTile = -1;
+  lastOAM = new Uint8Array(0x100);
+  lastSpriteMode = -1;
+  audioBlock = new Float32Array(2048); // one frame of samples, plus slack
+  audioLen = 0;
+  novideo = false;
   
   constructor(mainElement) {
     super();
@@ -87,31 +104,37 @@ class JSNESPlatform extends Base6502Platform implements Platform {
     this.audio = new SampleAudio(this.audioFrequency);
     this.video = new RasterVideo(this.mainElement,256,224,{overscan:true});
     this.video.create();
-    // debugging view
+    // debugging views: nametables, pattern tables, sprites (8x8 grid of 8x16 cells)
+    this.ptvideo = new RasterVideo(this.mainElement,256,128,{overscan:false});
+    this.ptvideo.create();
+    $(this.ptvideo.canvas).hide();
+    this.oamvideo = new RasterVideo(this.mainElement,64,128,{overscan:false});
+    this.oamvideo.create();
+    $(this.oamvideo.canvas).hide();
     this.ntvideo = new RasterVideo(this.mainElement,512,480,{overscan:false});
     this.ntvideo.create();
     $(this.ntvideo.canvas).hide();
-    this.ntlastbuf = new Uint32Array(0x1000);
     // toggle buttons (TODO)
     /*
     $('<button>').text("Video").appendTo(debugbar).click(() => { $(this.video.canvas).toggle() });
-    $('<button>').text("Nametable").appendTo(debugbar).click(() => { $(this.ntvideo.canvas).toggle() });
+    $('<button>').text("Nametable").appendTo(debugbar).click(() => { this.toggleDebugView('nt') });
+    $('<button>').text("Patterns").appendTo(debugbar).click(() => { this.toggleDebugView('pt') });
+    $('<button>').text("Sprites").appendTo(debugbar).click(() => { this.toggleDebugView('oam') });
     */
 
-    var idata = this.video.getFrameData();
     this.nes = new jsnes.NES({
-      onFrame: (frameBuffer : number[]) => {
-        for (var i=0; i<frameBuffer.length; i++)
-          idata[i] = frameBuffer[i] | 0xff000000;
-        this.video.updateFrame();
+      // the PPU draws straight into our frame buffer (see installFrameBuffer)
+      onFrame: (frameBuffer) => {
         this.frameindex++;
+        if (this.novideo) return;
+        this.fixClippedBorders();
+        this.video.updateFrame();
         this.updateDebugViews();
       },
       onAudioSample: (left:number, right:number) => {
-        if (this.frameindex < 10)
-          this.audio.feedSample(0, 1); // avoid popping at powerup
-        else
-          this.audio.feedSample(left+right, 1);
+        this.audioBlock[this.audioLen++] = left+right;
+        if (this.audioLen == this.audioBlock.length)
+          this.flushAudio();
       },
       onStatusUpdate: function(s) {
         console.log(s);
@@ -132,6 +155,22 @@ class JSNESPlatform extends Base6502Platform implements Platform {
       this.evalDebugCondition();
       return cycles;
     }
+    // track VRAM writes (they all go through writeMem with the physical address)
+    var ppu = this.nes.ppu;
+    var writeMem = ppu.writeMem;
+    ppu.writeMem = (address:number, value:number) => {
+      writeMem.call(ppu, address, value);
+      if (address < 0x2000)
+        this.ptdirty[address >> 4] = 1;
+      else if (address < 0x3000)
+        this.ntdirty[address & 0xfff] = 1;
+      this.vramChanged = true;
+    };
+    var setMirroring = ppu.setMirroring;
+    ppu.setMirroring = (mirroring) => {
+      setMirroring.call(ppu, mirroring);
+      this.debugFull = true;
+    };
     this.timer = new AnimationTimer(60, this.nextFrame.bind(this));
     // set keyboard map
     setKeyboardFromMap(this.video, [], JSNES_KEYCODE_MAP, (o,key,code,flags) => {
@@ -144,52 +183,212 @@ class JSNESPlatform extends Base6502Platform implements Platform {
   }
 
   advance(novideo : boolean) {
-    this.nes.frame();
+    this.novideo = novideo;
+    try {
+      this.nes.frame();
+    } finally {
+      this.novideo = false;
+    }
+    this.flushAudio();
+  }
+
+  flushAudio() {
+    if (this.frameindex < 10)
+      this.audioBlock.fill(0, 0, this.audioLen); // avoid popping at powerup
+    this.audio.feedBlock(this.audioBlock, this.audioLen);
+    this.audioLen = 0;
+  }
+
+  // Point the PPU's frame buffer at the RasterVideo pixels, and bake the alpha
+  // channel into its palette tables, so frames need no copying.
+  // jsnes recreates both when the PPU resets and replaces the buffer on
+  // fromJSON, so this is redone after loadROM and loadState.
+  // The video only shows the top 224 of the PPU's 240 lines; typed array
+  // writes past the end are ignored, so the bottom lines fall away for free.
+  installFrameBuffer() {
+    var ppu = this.nes.ppu;
+    var idata = this.video.getFrameData();
+    if (ppu.buffer !== idata) {
+      if (ppu.buffer) {
+        for (var i=0; i<idata.length; i++)
+          idata[i] = ppu.buffer[i] | 0xff000000;
+      }
+      ppu.buffer = idata;
+    }
+    var pal = ppu.palTable;
+    if (pal && !pal.alphaSet) {
+      var tables = [pal.curTable].concat(pal.emphTable || []);
+      for (var t of tables) {
+        for (var i=0; i<t.length; i++)
+          t[i] |= 0xff000000;
+      }
+      pal.alphaSet = true;
+      if (ppu.updatePalettes) ppu.updatePalettes();
+    }
+  }
+
+  // the PPU blanks clipped borders with 0, not a palette color
+  fixClippedBorders() {
+    var idata = this.video.getFrameData();
+    var i;
+    for (i=0; i<256*8; i++)
+      idata[i] |= 0xff000000;
+    for (; i<idata.length; i+=256) {
+      for (var x=0; x<8; x++) {
+        idata[i+x] |= 0xff000000;
+        idata[i+248+x] |= 0xff000000;
+      }
+    }
+  }
+
+  toggleDebugView(view : string) {
+    var video = this[view+'video'];
+    this[view+'visible'] = !this[view+'visible'];
+    $(video.canvas).toggle(this[view+'visible']);
+    this.debugFull = true;
   }
 
+  // Debug views only run while shown, and then only redraw tiles whose
+  // nametable/attribute bytes, pattern or palette changed since last frame.
   updateDebugViews() {
-   // don't update if view is hidden
-   if (! $(this.ntvideo.canvas).is(":visible"))
-     return;
-   var a = 0;
-   var attraddr = 0;
-   var idata = this.ntvideo.getFrameData();
-   var baseTile = this.nes.ppu.regS === 0 ? 0 : 256;
-   for (var row=0; row<60; row++) {
-     for (var col=0; col<64; col++) {
-       a = 0x2000 + (col&31) + ((row%30)*32);
-       if (col >= 32) a += 0x400;
-       if (row >= 30) a += 0x800;
-       var name = this.nes.ppu.mirroredLoad(a) + baseTile;
-       var t = this.nes.ppu.ptTile[name];
-       attraddr = (a & 0x2c00) | 0x3c0 | (a & 0x0C00) | ((a >> 4) & 0x38) | ((a >> 2) & 0x07);
-       var attr = this.nes.ppu.mirroredLoad(attraddr);
-       var tag = name ^ (attr<<9) ^ 0x80000000;
-       if (tag != this.ntlastbuf[a & 0xfff]) {
-         this.ntlastbuf[a & 0xfff] = tag;
-         var i = row*64*8*8 + col*8;
-         var j = 0;
-         var attrshift = (col&2) + ((a&0x40)>>4);
-         var coloradd = ((attr >> attrshift) & 3) << 2;
-         for (var y=0; y<8; y++) {
-           for (var x=0; x<8; x++) {
-             var color = t.pix[j++];
-             if (color) color += coloradd;
-             var rgb = this.nes.ppu.imgPalette[color];
-             idata[i++] = rgb | 0xff000000;
-           }
-           i += 64*8-8;
-         }
-       }
-     }
-   }
-   this.ntvideo.updateFrame();
+    if (!this.ntvisible && !this.ptvisible && !this.oamvisible)
+      return;
+    var ppu = this.nes.ppu;
+    for (var i=0; i<512; i++) {
+      if (ppu.ptTile[i] !== this.ptlast[i]) {
+        this.ptlast[i] = ppu.ptTile[i];
+        this.ptdirty[i] = 1;
+        this.vramChanged = true;
+      }
+    }
+    for (var i=0; i<16; i++) {
+      if ((ppu.imgPalette[i]|0) != this.lastPalette[i] || (ppu.sprPalette[i]|0) != this.lastPalette[i+16]) {
+        this.lastPalette[i] = ppu.imgPalette[i]|0;
+        this.lastPalette[i+16] = ppu.sprPalette[i]|0;
+        this.debugFull = true;
+      }
+    }
+    var full = this.debugFull;
+    if (this.ntvisible && (full || this.vramChanged))
+      this.updateNametableView(full);
+    if (this.ptvisible && (full || this.vramChanged))
+      this.updatePatternView(full);
+    if (this.oamvisible)
+      this.updateOAMView(full);
+    if (this.vramChanged) {
+      this.ntdirty.fill(0);
+      this.ptdirty.fill(0);
+      this.vramChanged = false;
+    }
+    this.debugFull = false;
+  }
+
+  drawDebugTile(idata:Uint32Array, i:number, pitch:number, t, palette, coloradd:number, flip:number) {
+    var pix = t.pix;
+    for (var y=0; y<8; y++) {
+      var j = ((flip & 2) ? 7-y : y) * 8;
+      for (var x=0; x<8; x++) {
+        var color = pix[(flip & 1) ? j+7-x : j+x];
+        if (color) color += coloradd;
+        idata[i++] = palette[color] | 0xff000000;
+      }
+      i += pitch-8;
+    }
+  }
+
+  updateNametableView(full:boolean) {
+    var ppu = this.nes.ppu;
+    var idata = this.ntvideo.getFrameData();
+    var baseTile = ppu.regS === 0 ? 0 : 256;
+    if (baseTile != this.lastBaseTile) {
+      this.lastBaseTile = baseTile;
+      full = true;
+    }
+    var mirror = ppu.vramMirrorTable;
+    var ntdirty = this.ntdirty;
+    var ptdirty = this.ptdirty;
+    for (var row=0; row<60; row++) {
+      for (var col=0; col<64; col++) {
+        var a = 0x2000 + (col&31) + ((row%30)*32);
+        if (col >= 32) a += 0x400;
+        if (row >= 30) a += 0x800;
+        var attraddr = (a & 0x2c00) | 0x3c0 | (a & 0x0C00) | ((a >> 4) & 0x38) | ((a >> 2) & 0x07);
+        var na = mirror[a];
+        var aa = mirror[attraddr];
+        var name = ppu.vramMem[na] + baseTile;
+        if (full || ntdirty[na & 0xfff] || ntdirty[aa & 0xfff] || ptdirty[name]) {
+          var attr = ppu.vramMem[aa];
+          var attrshift = (col&2) + ((a&0x40)>>4);
+          var coloradd = ((attr >> attrshift) & 3) << 2;
+          this.drawDebugTile(idata, row*64*8*8 + col*8, 64*8, ppu.ptTile[name], ppu.imgPalette, coloradd, 0);
+        }
+      }
+    }
+    this.ntvideo.updateFrame();
+  }
+
+  updatePatternView(full:boolean) {
+    var ppu = this.nes.ppu;
+    var idata = this.ptvideo.getFrameData();
+    for (var t=0; t<512; t++) {
+      if (full || this.ptdirty[t]) {
+        var i = (t>>8)*128 + (t&15)*8 + ((t>>4)&15)*8*256;
+        this.drawDebugTile(idata, i, 256, ppu.ptTile[t], ppu.imgPalette, 0, 0);
+      }
+    }
+    this.ptvideo.updateFrame();
+  }
+
+  updateOAMView(full:boolean) {
+    var ppu = this.nes.ppu;
+    var idata = this.oamvideo.getFrameData();
+    var oam = ppu.spriteMem;
+    var tall = ppu.f_spriteSize;
+    var mode = (tall ? 2 : 0) + (ppu.f_spPatternTable ? 1 : 0);
+    if (mode != this.lastSpriteMode) {
+      this.lastSpriteMode = mode;
+      full = true;
+    }
+    var changed = full || this.vramChanged;
+    for (var n=0; n<64; n++) {
+      var tile = oam[n*4+1];
+      var attr = oam[n*4+2];
+      var top, bottom;
+      if (tall) {
+        top = (tile & 1)*256 + (tile & 0xfe);
+        bottom = top + 1;
+      } else {
+        top = tile + (ppu.f_spPatternTable ? 256 : 0);
+        bottom = -1;
+      }
+      if (!full && tile == this.lastOAM[n*4+1] && attr == this.lastOAM[n*4+2] &&
+          !(changed && (this.ptdirty[top] || (bottom >= 0 && this.ptdirty[bottom]))))
+        continue;
+      this.lastOAM[n*4+1] = tile;
+      this.lastOAM[n*4+2] = attr;
+      var i = (n&7)*8 + (n>>3)*16*64;
+      var flip = attr >> 6;
+      var coloradd = (attr & 3) << 2;
+      if (bottom < 0) {
+        this.drawDebugTile(idata, i, 64, ppu.ptTile[top], ppu.sprPalette, coloradd, flip);
+        for (var j=i+8*64; j<i+16*64; j+=64)
+          idata.fill(0xff000000, j, j+8);
+      } else {
+        // vertical flip also swaps the two halves
+        this.drawDebugTile(idata, i, 64, ppu.ptTile[(flip & 2) ? bottom : top], ppu.sprPalette, coloradd, flip);
+        this.drawDebugTile(idata, i+8*64, 64, ppu.ptTile[(flip & 2) ? top : bottom], ppu.sprPalette, coloradd, flip);
+      }
+    }
+    this.oamvideo.updateFrame();
   }
 
   loadROM(title, data) {
     var romstr = byteArrayToString(data);
     this.nes.loadROM(romstr);
+    this.installFrameBuffer();
     this.frameindex = 0;
+    this.audioLen = 0;
+    this.debugFull = true;
   }
   newCodeAnalyzer() {
     return new CodeAnalyzer_nes(this);
@@ -245,6 +444,7 @@ class JSNESPlatform extends Base6502Platform implements Platform {
     return s;
   }
   loadState(state) {
+    var vram = this.nes.ppu.vramMem;
     this.unfixPC(state.cpu);
     this.nes.fromJSON(state);
     this.fixPC(state.cpu);
@@ -254,6 +454,17 @@ class JSNESPlatform extends Base6502Platform implements Platform {
     this.nes.cpu.mem = state.cpu.mem.slice(0);
     this.nes.ppu.vramMem = state.ppu.vramMem.slice(0);
     this.nes.ppu.spriteMem = state.ppu.spriteMem.slice(0);
+    this.installFrameBuffer();
+    // debug views only redraw the tiles the state changes
+    for (var a=0; a<0x3000; a++) {
+      if (vram[a] !== state.ppu.vramMem[a]) {
+        if (a < 0x2000)
+          this.ptdirty[a >> 4] = 1;
+        else
+          this.ntdirty[a & 0xfff] = 1;
+        this.vramChanged = true;
+      }
+    }
     this.loadControlsState(state.ctrl);
     //$.extend(this.nes, state);
   }
@@ -158,6 +158,7 @@ class SG1000Platform extends BasicZ80ScanlinePlatform implements Platform {
     super.reset();
     this.vdp.reset();
     this.psg.reset();
+    this.cpu.setCodeCache(0x0000, 0xbfff, true);
   }
 
   getDebugCategories() {
@@ -190,6 +191,15 @@ class SMSPlatform extends SG1000Platform {
     this.pagingRegisters.set([0,0,1,2]);
   }
 
+  // drop compiled code in a slot when its page changes; cartridge RAM isn't cached
+  updateCodeCache(reg:number) {
+    switch (reg) {
+      case 1: this.cpu.setCodeCache(0x0400, 0x3fff, true); break;
+      case 2: this.cpu.setCodeCache(0x4000, 0x7fff, true); break;
+      default: this.cpu.setCodeCache(0x8000, 0xbfff, !(this.pagingRegisters[0] & 0x8)); break;
+    }
+  }
+
   newVDP(frameData, cru, flicker) {
     return new SMSVDP(frameData, cru, flicker);
   }
@@ -244,7 +254,10 @@ class SMSPlatform extends SG1000Platform {
            this.ram[a] = v;
          }],
          [0xfffc, 0xffff,    0x3, (a,v) => {
-           this.pagingRegisters[a] = v;
+           if (this.pagingRegisters[a] != v) {
+             this.pagingRegisters[a] = v;
+             this.updateCodeCache(a);
+           }
            this.ram[a+0x1ffc] = v;
          }],
          [0x8000, 0xbfff, 0x3fff, (a,v) => {
@@ -284,6 +297,8 @@ class SMSPlatform extends SG1000Platform {
   loadState(state) {
     super.loadState(state);
     this.pagingRegisters.set(state.pr);
+    for (var reg=1; reg<4; reg++)
+      this.updateCodeCache(reg);
     this.cartram.set(state.cr);
     this.latchedHCounter = state.lhc;
     this.ioControlFlags = state.iocf;
@@ -5,6 +5,8 @@ import { PLATFORMS, RAM, newAddressDecoder, padBytes, noise, setKeyboardFromMap,
 import { hex } from "../util";
 import { SampleAudio } from "../audio";
 
+declare var Z80_fast;
+
 var WILLIAMS_SOUND_PRESETS = [
   {id:'swave.c', name:'Wavetable Synth'},
 ];
@@ -33,6 +35,90 @@ var WILLIAMS_SOUND_PRESETS = [
 
 ****************************************************************************/
 
+var cpuFrequency = 18432000/6; // 3.072 MHz
+var cpuAudioFactor = 32;
+
+// ROM at 0000-3fff, RAM mirrored through 4000-7fff
+function newSoundMemoryBus(getROM:() => Uint8Array, ram:Uint8Array) {
+  return {
+    read: function(a:number) : number {
+      if (a < 0x4000) { var rom = getROM(); return rom ? rom[a] : 0; }
+      return a < 0x8000 ? ram[a & 0x3ff] : 0;
+    },
+    write: function(a:number, v:number) {
+      if (a >= 0x4000 && a < 0x8000) ram[a & 0x3ff] = v;
+    },
+    isContended: function() { return false; },
+  };
+}
+
+export interface WilliamsSoundCommand {
+  time : number;    // seconds from start
+  command : number; // sound command latch
+}
+
+export interface WilliamsSoundRender {
+  samples : Int16Array;
+  sampleRate : number;
+  realtime : number; // render speed, in multiples of real time
+}
+
+// Renders a sound ROM without video or Web Audio, as fast as the CPU goes.
+// Each command resets the sound CPU with the command latch set, like a keypress.
+export function renderWilliamsSound(data:Uint8Array, commands:WilliamsSoundCommand[], seconds:number, samples?:Int16Array) : WilliamsSoundRender {
+  var t0 = new Date().getTime();
+  var rom = padBytes(data, 0x4000);
+  var ram = new RAM(0x400).mem;
+  var command = 0;
+  var dac = 0;
+  var last_tstate = 0;
+  var sampleRate = cpuFrequency / cpuAudioFactor;
+  var numSamples = Math.floor(seconds * sampleRate);
+  if (!samples || samples.length < numSamples) samples = new Int16Array(numSamples);
+  var cpu;
+  var fillBuffer = function() {
+    var t = Math.min(numSamples, cpu.getTstates() / cpuAudioFactor);
+    while (last_tstate < t) {
+      samples[last_tstate++] = dac;
+    }
+  };
+  cpu = Z80_fast({
+    display: {},
+    memory: newSoundMemoryBus(function() { return rom; }, ram),
+    ioBus: {
+      read: function(addr) { return command & 0xff; },
+      write: function(addr, val) {
+        fillBuffer();
+        dac = (val & 0x80 ? (val & 0xff) - 256 : val & 0xff) << 8;
+      }
+    }
+  });
+  cpu.setCodeCache(0x0000, 0x3fff, true);
+  cpu.enableCodeCache(true);
+  cpu.reset();
+  var cmds = commands.slice(0).sort(function(a,b) { return a.time - b.time; });
+  var endTstates = numSamples * cpuAudioFactor;
+  for (var i=0; i<=cmds.length; i++) {
+    var target = i < cmds.length ? Math.min(endTstates, Math.floor(cmds[i].time * cpuFrequency)) : endTstates;
+    if (cpu.getHalted())
+      cpu.setTstates(Math.max(target, cpu.getTstates()));
+    else
+      cpu.runFrame(target);
+    if (i < cmds.length) {
+      command = cmds[i].command & 0xff;
+      cpu.reset();
+    }
+  }
+  cpu.setTstates(endTstates);
+  fillBuffer();
+  var elapsed = Math.max(1, new Date().getTime() - t0) / 1000;
+  return {
+    samples: samples.length > numSamples ? samples.subarray(0, numSamples) : samples,
+    sampleRate: sampleRate,
+    realtime: seconds / elapsed
+  };
+}
+
 var WilliamsSoundPlatform = function(mainElement) {
   var self = this;
   this.__proto__ = new (BaseZ80Platform as any)();
@@ -47,9 +133,7 @@ var WilliamsSoundPlatform = function(mainElement) {
   var last_tstate;
   var pixels;
 
-  var cpuFrequency = 18432000/6; // 3.072 MHz
   var cpuCyclesPerFrame = cpuFrequency/60;
-  var cpuAudioFactor = 32;
 
   function fillBuffer() {
     var t = cpu.getTstates() / cpuAudioFactor;
@@ -64,16 +148,7 @@ var WilliamsSoundPlatform = function(mainElement) {
 
   this.start = function() {
     ram = new RAM(0x400);
-    membus = {
-      read: newAddressDecoder([
-				[0x0000, 0x3fff, 0x3fff, function(a) { return rom ? rom[a] : null; }],
-				[0x4000, 0x7fff, 0x3ff,  function(a) { return ram.mem[a]; }]
-			]),
-			write: newAddressDecoder([
-				[0x4000, 0x7fff, 0x3ff,  function(a,v) { ram.mem[a] = v; }],
-			]),
-      isContended: function() { return false; },
-    };
+    membus = newSoundMemoryBus(function() { return rom; }, ram.mem);
     iobus = {
       read: function(addr) {
         return command & 0xff;
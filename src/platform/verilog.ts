@@ -4,7 +4,7 @@ import { Platform, BasePlatform } from "../baseplatform";
 import { PLATFORMS, setKeyboardFromMap, AnimationTimer, RasterVideo, Keys, makeKeycodeMap, getMousePos } from "../emu";
 import { SampleAudio } from "../audio";
 import { safe_extend, clamp } from "../util";
-import { WaveformView, WaveformProvider, WaveformMeta } from "../waveform";
+import { WaveformView, WaveformProvider, WaveformMeta, WaveformTraceBuffer, VCDWriter } from "../waveform";
 import { setFrameRateUI } from "../ui";
 
 declare var Split;
@@ -66,6 +66,9 @@ var VERILOG_KEYCODE_MAP = makeKeycodeMap([
 export var vl_finished = false;
 export var vl_stopped = false;
 
+// headless capture holds reset for this many half-clocks after power-on
+const VL_RESET_HALFCLOCKS = 3;
+
 export function VL_UL(x) { return x|0; }
 export function VL_ULL(x) { return x|0; }
 export function VL_TIME_Q() { return (new Date().getTime())|0; }
@@ -134,6 +137,7 @@ abstract class VerilatorBase {
   clk = 0;
   reset = 0;
   enable?;
+  __Vm_noFeedback? : boolean;
 
   vl_fatal(msg:string) {
     console.log(msg);
@@ -160,6 +164,12 @@ abstract class VerilatorBase {
     }
   }
 
+  // power-on sequence, shared by the platform and headless capture
+  __powerOn() {
+    this._ctor_var_reset();
+    this.__reset();
+  }
+
   tick2() {
     this.clk = 0;
     this.eval();
@@ -173,12 +183,20 @@ abstract class VerilatorBase {
   abstract _change_request(vlSymsp);
   abstract _eval_initial(vlSymsp);
   abstract _eval_settle(vlSymsp);
+  abstract _ctor_var_reset();
 
   eval() {
     let vlSymsp = this; //{TOPp:this};
     // Initialize
     if (!vlSymsp.__Vm_didInit)
       this._eval_initial_loop(vlSymsp);
+    // no combinational feedback, so one pass always settles
+    if (this.__Vm_noFeedback) {
+      vlSymsp.__Vm_activity = true;
+      this._eval(vlSymsp);
+      this.totalTicks++;
+      return;
+    }
     // Evaluate till stable
     //VL_DEBUG_IF(VL_PRINTF("\n----TOP Evaluate Vmain::eval\n"); );
     var __VclockLoop = 0;
@@ -217,6 +235,38 @@ abstract class VerilatorBase {
   }
 }
 
+// HEADLESS CAPTURE
+
+// run a translated model for ncycles half-clocks, streaming every sample to a VCD sink
+export function captureVCD(output, ncycles:number, sink:(s:string) => void) : number {
+  var mod : any = new Function('base', output.code);
+  var top = new mod();
+  top.__proto__ = new (VerilatorBase as any)();
+  var signals = output.ports.concat(output.signals).filter((v) => {
+    return !v.name.startsWith("__V") && !v.arrdim;
+  });
+  var meta = signals.map((v) => { return {label:v.name.replace(/__DOT__/g, "."), len:v.len}; });
+  var values = new Uint32Array(signals.length);
+  var writer = new VCDWriter(meta, sink);
+  writer.writeHeader(output.name ? output.name.substr(1) : "top", "1ns");
+  vl_finished = vl_stopped = false;
+  top.__powerOn();
+  var t;
+  for (t=0; t<ncycles && !(vl_finished || vl_stopped); t++) {
+    top.clk ^= 1;
+    top.eval();
+    // like the platform, release reset after the first slice of clocks
+    if (t == VL_RESET_HALFCLOCKS-1) top.__unreset();
+    for (var i=0; i<signals.length; i++) {
+      var z = top[signals[i].name];
+      values[i] = (typeof(z) === 'number') ? z : 0;
+    }
+    writer.writeSample(t, values, 0);
+  }
+  writer.close(t);
+  return t;
+}
+
 // PLATFORM
 
 var VerilogPlatform = function(mainElement, options) {
@@ -243,8 +293,10 @@ var VerilogPlatform = function(mainElement, options) {
   var module_name;
   //var trace_ports;
   var trace_signals;
-  var trace_buffer;
-  var trace_index;
+  var trace_buffer : WaveformTraceBuffer;
+  var trace_values : Uint32Array; // scratch for non-contiguous signals
+  var trace_sigidx = -1; // first __sig index, if traced signals are contiguous
+  const TRACE_BUFFER_WORDS = 0x400000;
 
   // for virtual CRT
   var framex=0;
@@ -275,6 +327,10 @@ var VerilogPlatform = function(mainElement, options) {
   var debugCond;
   var frameRate = 0;
 
+  // for ticks/sec display
+  var tickrate_time = 0;
+  var tickrate_ticks = 0;
+
   function vidtick() {
     gen.tick2();
     if (useAudio)
@@ -338,7 +394,6 @@ var VerilogPlatform = function(mainElement, options) {
     };
     this.setFrameRate(60);
     // setup scope
-    trace_buffer = new Uint32Array(0x20000);
     var overlay = $("#emuoverlay").show();
     this.topdiv = $('<div class="emuspacer">').appendTo(overlay);
     vcanvas.appendTo(this.topdiv);
@@ -410,7 +465,7 @@ var VerilogPlatform = function(mainElement, options) {
     this.refreshVideoFrame();
     // set scope offset
     if (trace && this.waveview) {
-      this.waveview.setEndTime(Math.floor(trace_index/trace_signals.length));
+      this.waveview.setEndTime(trace_buffer.total);
     }
   }
   
@@ -441,7 +496,7 @@ var VerilogPlatform = function(mainElement, options) {
   updateScopeFrame() {
     this.split.setSizes([0,100]); // ensure scope visible
     //this.topdiv.hide();// hide crt
-    var done = this.fillTraceBuffer(32 * trace_signals.length); // TODO: const
+    var done = this.fillTraceBuffer(32); // TODO: const
     if (done)
       this.pause(); // TODO?
     // TODO
@@ -460,6 +515,7 @@ var VerilogPlatform = function(mainElement, options) {
 
   updateFrame() {
     if (!gen) return;
+    this.updateTickRate();
     if (this.hasvideo)
       this.updateVideoFrame();
     else
@@ -496,11 +552,15 @@ var VerilogPlatform = function(mainElement, options) {
   updateVideoFrameCycles(ncycles:number, sync:boolean, trace:boolean) {
     ncycles |= 0;
     var inspect = inspect_obj && inspect_sym;
-    var trace0 = trace_index;
+    if (!trace && !inspect && !debugCond) {
+      this.updateVideoFrameCyclesFast(ncycles, sync);
+      return;
+    }
+    var trace0 = trace_buffer ? trace_buffer.total : 0;
     while (ncycles--) {
       if (trace) {
         this.snapshotTrace();
-        if (trace_index == trace0) trace = false; // kill trace when wraps around
+        if (trace_buffer.total - trace0 >= trace_buffer.capacity) trace = false; // kill trace when wraps around
       }
       vidtick();
       if (framex++ < videoWidth) {
@@ -538,50 +598,143 @@ var VerilogPlatform = function(mainElement, options) {
     }
   }
 
+  // same as updateVideoFrameCycles() without trace, inspect or debug.
+  // the visible part of each scanline runs as a batch that skips the
+  // hsync test; vsync is still sampled every tick, since it can assert mid-line
+  updateVideoFrameCyclesFast(ncycles:number, sync:boolean) {
+    var _gen = gen;
+    var _idata = idata;
+    var feed = useAudio;
+    while (ncycles > 0) {
+      if (framex < videoWidth) {
+        var n = Math.min(videoWidth - framex, ncycles);
+        var drawing = framey < videoHeight;
+        var i = 0;
+        while (i < n) {
+          i++;
+          _gen.tick2();
+          if (feed)
+            audio.feedSample(_gen.spkr*(1.0/255.0), 1);
+          framex++;
+          if (drawing)
+            _idata[frameidx++] = RGBLOOKUP[_gen.rgb & 15];
+          if (_gen.vsync) {
+            this.startVideoFrame();
+            break; // resume as a new scanline
+          } else if (framevsync) {
+            framevsync = false;
+            if (sync) {
+              this.updateRecorder();
+              return; // exit when vsync ends
+            }
+          }
+        }
+        ncycles -= i;
+      } else {
+        ncycles--;
+        _gen.tick2();
+        if (feed)
+          audio.feedSample(_gen.spkr*(1.0/255.0), 1);
+        framex++;
+        if (!framehsync && _gen.hsync) {
+          framehsync = true;
+        } else if ((framehsync && !_gen.hsync) || framex > videoWidth*2) {
+          framehsync = false;
+          framex = 0;
+          framey++;
+          _gen.hpaddle = framey > video.paddle_x ? 1 : 0;
+          _gen.vpaddle = framey > video.paddle_y ? 1 : 0;
+        }
+        if (framey > maxVideoLines || _gen.vsync) {
+          this.startVideoFrame();
+        } else if (framevsync) {
+          framevsync = false;
+          if (sync) {
+            this.updateRecorder();
+            return; // exit when vsync ends
+          }
+        }
+      }
+    }
+  }
+
+  startVideoFrame() {
+    framevsync = true;
+    framey = 0;
+    framex = 0;
+    frameidx = 0;
+    gen.hpaddle = 0;
+    gen.vpaddle = 0;
+  }
+
+  // measure ticks/sec of the current design, once a second
+  updateTickRate() {
+    var now = Date.now();
+    if (!tickrate_time) {
+      tickrate_time = now;
+      tickrate_ticks = gen.ticks();
+    } else if (now - tickrate_time >= 1000) {
+      var rate = (gen.ticks() - tickrate_ticks) * 1000 / (now - tickrate_time);
+      tickrate_time = now;
+      tickrate_ticks = gen.ticks();
+      $("#tickrate_label").text(rate >= 1e6 ? (rate/1e6).toFixed(2)+"M" : rate >= 1e3 ? (rate/1e3).toFixed(1)+"K" : rate.toFixed(0));
+    }
+  }
+
   snapshotTrace() {
-    var arr = trace_signals;
-    for (var i=0; i<arr.length; i++) {
-      var v = arr[i];
-      var z = gen[v.name];
-      if (typeof(z) === 'number')
-        trace_buffer[trace_index] = z;
-      trace_index++;
+    if (trace_sigidx >= 0) {
+      // all traced signals are adjacent in __sig
+      trace_buffer.append(gen.__sig, trace_sigidx);
+    } else {
+      var arr = trace_signals;
+      for (var i=0; i<arr.length; i++) {
+        var z = gen[arr[i].name];
+        trace_values[i] = (typeof(z) === 'number') ? z : 0;
+      }
+      trace_buffer.append(trace_values, 0);
     }
-    if (trace_index >= trace_buffer.length - arr.length)
-      trace_index = 0;
   }
 
   fillTraceBuffer(count:number) : boolean {
-    var max_index = Math.min(trace_buffer.length - trace_signals.length, trace_index + count);
-    while (trace_index < max_index) {
+    var max_index = Math.min(trace_buffer.capacity, trace_buffer.total + count);
+    while (trace_buffer.total < max_index) {
       gen.clk ^= 1;
       gen.eval();
       this.snapshotTrace();
-      if (trace_index == 0)
-        break;
     }
     gen.__unreset();
-    return (trace_index == 0);
+    return trace_buffer.isFull();
   }
   
+  // sort traced signals in storage order, so we can snapshot them straight from __sig
+  setupTraceLayout() {
+    trace_buffer = new WaveformTraceBuffer(trace_signals.length, TRACE_BUFFER_WORDS);
+    trace_values = new Uint32Array(trace_signals.length);
+    trace_sigidx = -1;
+    if (!gen.__sig || !trace_signals.length) return;
+    for (var v of trace_signals)
+      if (v.sigidx === undefined) return;
+    trace_signals.sort((a,b) => { return a.sigidx - b.sigidx; });
+    var first = trace_signals[0].sigidx;
+    for (var i=0; i<trace_signals.length; i++)
+      if (trace_signals[i].sigidx != first + i) return;
+    trace_sigidx = first;
+  }
+
   getSignalMetadata() : WaveformMeta[] {
     return trace_signals;
   }
   
-  getSignalData(index:number, start:number, len:number) : number[] {
-    // TODO: not efficient
-    var skip = this.getSignalMetadata().length;
-    var last = trace_buffer.length - trace_signals.length; // TODO: refactor, and not correct
-    var wrap = this.hasvideo; // TODO?
-    var a = [];
-    index += skip * start;
-    while (index < last && a.length < len) {
-      a.push(trace_buffer[index]);
-      index += skip;
-      if (wrap && index >= last) // TODO: what if starts with index==last
-        index = 0;
-    }
-    return a;
+  getSignalData(index:number, start:number, len:number) : ArrayLike<number> {
+    return trace_buffer.getSlice(index, start, len);
+  }
+
+  getSignalMinMax(index:number, start:number, step:number, mins:Uint32Array, maxs:Uint32Array) : number {
+    return trace_buffer.getMinMax(index, start, step, mins, maxs);
+  }
+
+  getFirstTime() : number {
+    return trace_buffer ? trace_buffer.getFirstTime() : 0;
   }
 
   printErrorCodeContext(e, code) {
@@ -619,10 +772,10 @@ var VerilogPlatform = function(mainElement, options) {
         //trace_ports = current_output.ports;
         trace_signals = current_output.ports.concat(current_output.signals);	// combine ports + signals
         trace_signals = trace_signals.filter((v) => { return !v.name.startsWith("__V"); }); // remove __Vclklast etc
+        trace_signals = trace_signals.filter((v) => { return !v.arrdim; }); // remove memories
         for (var v of trace_signals) {
           v.label = v.name.replace(/__DOT__/g, ".");	// make nicer name
         }
-        trace_index = 0;
         // power on module
         this.poweron();
         // query output
@@ -634,6 +787,10 @@ var VerilogPlatform = function(mainElement, options) {
         } else {
           $("#speed_bar").hide();
         }
+        tickrate_time = 0;
+        $("#tickrate_label").text("");
+        $("#tickrate_bar").show();
+        this.setupTraceLayout();
       }
     }
     // replace program ROM, if using the assembler
@@ -641,6 +798,8 @@ var VerilogPlatform = function(mainElement, options) {
       if (gen[output.program_rom_variable]) {
         if (gen[output.program_rom_variable].length != output.program_rom.length)
           alert("ROM size mismatch -- expected " + gen[output.program_rom_variable].length + " got " + output.program_rom.length);
+        else if (gen[output.program_rom_variable].set)
+          gen[output.program_rom_variable].set(output.program_rom); // keep typed array identity
         else
           gen[output.program_rom_variable] = output.program_rom;
       } else {
@@ -676,6 +835,7 @@ var VerilogPlatform = function(mainElement, options) {
     if (audio) audio.stop();
   }
   resume() {
+    tickrate_time = 0;
     timer.start();
     if (audio) audio.start();
   }
@@ -698,14 +858,17 @@ var VerilogPlatform = function(mainElement, options) {
   getFrameRate() { return frameRate; }
 
   poweron() {
-    gen._ctor_var_reset();
-    this.reset();
+    if (!gen) return;
+    gen.__powerOn();
+    this.resetState();
   }
   reset() {
     if (!gen) return;
     gen.__reset();
-    trace_index = 0;
-    if (trace_buffer) trace_buffer.fill(0);
+    this.resetState();
+  }
+  resetState() {
+    if (trace_buffer) trace_buffer.clear();
     if (video) video.setRotate(gen.rotate ? -90 : 0);
     $("#verilog_bar").hide();
     if (!this.hasvideo) this.resume(); // TODO?
@@ -753,7 +916,16 @@ var VerilogPlatform = function(mainElement, options) {
     return state;
   }
   loadState(state) {
-    gen = safe_extend(true, gen, state.o);
+    // copy typed arrays in place, since the model's functions hold references to them
+    var o = {};
+    for (var key in state.o) {
+      var val = state.o[key];
+      if (val && val.subarray && gen[key] && gen[key].length == val.length)
+        gen[key].set(val);
+      else
+        o[key] = val;
+    }
+    gen = safe_extend(true, gen, o);
     gen.setTicks(state.T);
     gen.TOPp = gen;
     //console.log(gen, state.o);
@@ -1,6 +1,7 @@
 "use strict";
 
 import { Platform, BaseZ80Platform  } from "../baseplatform";
+import { CodeAnalyzer_z80 } from "../analysis";
 import { PLATFORMS, RAM, newAddressDecoder, padBytes, noise, setKeyboardFromMap, AnimationTimer, RasterVideo, Keys, makeKeycodeMap } from "../emu";
 import { hex } from "../util";
 import { MasterAudio, AY38910_Audio } from "../audio";
@@ -163,7 +164,7 @@ const _VicDualPlatform = function(mainElement) {
       if (sl == vsyncEnd) inputs[1] &= ~0x8;
       this.runCPU(cpu, targetTstates - cpu.getTstates());
     }
-    video.updateFrame();
+    if (!novideo) video.updateFrame();
   }
 
   loadROM(title, data) {
@@ -208,6 +209,9 @@ const _VicDualPlatform = function(mainElement) {
   getCPUState() {
     return cpu.saveState();
   }
+  newCodeAnalyzer() {
+    return new CodeAnalyzer_z80(this, cpuCyclesPerLine);
+  }
 
   isRunning() {
     return timer && timer.isRunning();
@@ -222,6 +226,7 @@ const _VicDualPlatform = function(mainElement) {
   }
   reset() {
     cpu.reset();
+    cpu.setCodeCache(0x0000, 0x7fff, true);
 		psg.reset();
     if (!this.getDebugCallback()) cpu.setTstates(0); // TODO?
   }
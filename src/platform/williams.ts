@@ -26,12 +26,13 @@ var WilliamsPlatform = function(mainElement, proto) {
   var pia6821 = new RAM(8).mem;
   var blitregs = new RAM(8).mem;
 
-  var video, timer, pixels, displayPCs;
+  var video, timer, pixels;
   var screenNeedsRefresh = false;
   var membus;
   var video_counter;
 
   var audio, worker, workerchannel;
+  var frameStartClock = 0;
 
   var xtal = 12000000;
   var cpuFrequency = xtal/3/4;
@@ -136,16 +137,30 @@ var WilliamsPlatform = function(mainElement, proto) {
 
   var iowrite_williams = newAddressDecoder([
     [0x0,   0xf,   0xf,   setPalette],
-    [0x80c, 0x80c, 0xf,   function(a,v) { if (worker) worker.postMessage({command:v}); }],
+    [0x80c, 0x80c, 0xf,   function(a,v) { if (workerchannel && v) workerchannel.sendCommand(cpu.getTstates() - frameStartClock, v); }],
     //[0x804, 0x807, 0x3,   function(a,v) { console.log('iowrite',a); }], // TODO: sound
     //[0x80c, 0x80f, 0x3,   function(a,v) { console.log('iowrite',a+4); }], // TODO: sound
-    [0x900, 0x9ff, 0,     function(a,v) { banksel = v & 0x1; }],
+    [0x900, 0x9ff, 0,     function(a,v) { setBank(v & 0x1); }],
     [0xa00, 0xa07, 0x7,   setBlitter],
     [0xbff, 0xbff, 0,     function(a,v) { if (v == 0x39) watchdog_counter = INITIAL_WATCHDOG; }],
     [0xc00, 0xfff, 0x3ff, function(a,v) { nvram.mem[a] = v; }],
     //[0x0,   0xfff, 0,     function(a,v) { console.log('iowrite',hex(a),hex(v)); }],
   ]);
 
+  // ROM banked over 0x0000-0x8fff, and fixed at 0xd000-0xffff
+  function setBank(v) {
+    if (v != banksel) {
+      banksel = v;
+      updateCodeCache();
+    }
+  }
+  function updateCodeCache() {
+    if (cpu.setCodeCache) {
+      cpu.setCodeCache(0x0000, 0x8fff, banksel != 0);
+      cpu.setCodeCache(0xd000, 0xffff, true);
+    }
+  }
+
   var memread_williams = newAddressDecoder([
     [0x0000, 0x8fff, 0xffff, function(a) { return banksel ? rom[a] : ram.mem[a]; }],
     [0x9000, 0xbfff, 0xffff, function(a) { return ram.mem[a]; }],
@@ -174,7 +189,6 @@ var WilliamsPlatform = function(mainElement, proto) {
   function write_display_byte(a:number,v:number) {
     ram.mem[a] = v;
     drawDisplayByte(a, v);
-    if (displayPCs) displayPCs[a] = cpu.getPC(); // save program counter
   }
 
   function drawDisplayByte(a,v) {
@@ -183,6 +197,12 @@ var WilliamsPlatform = function(mainElement, proto) {
     pixels[ofs+256] = palette[v&0xf];
   }
 
+  function redrawScreen() {
+    for (var i=0; i<0x9800; i++)
+      drawDisplayByte(i, ram.mem[i]);
+    screenNeedsRefresh = false;
+  }
+
   function setBlitter(a,v) {
     if (a) {
       blitregs[a] = v;
@@ -192,10 +212,33 @@ var WilliamsPlatform = function(mainElement, proto) {
     }
   }
 
+  // what part of the original dest byte a blit keeps, based on the
+  // FG only (0x08), no even (0x80) and no odd (0x40) flags and the source byte
+  function blitKeepMask(flags, srcdata) {
+    var keepmask = 0xff;
+    //even pixel (D7-D4)
+    if((flags & 0x8) && !(srcdata & 0xf0)) {   //FG only and src even pixel=0
+        if(flags & 0x80) keepmask &= 0x0f; // no even
+    } else {
+        if(!(flags & 0x80)) keepmask &= 0x0f; // not no even
+    }
+    //odd pixel (D3-D0)
+    if((flags & 0x8) && !(srcdata & 0x0f)) {   //FG only and src odd pixel=0
+        if(flags & 0x40) keepmask &= 0xf0; // no odd
+    } else {
+        if(!(flags & 0x40)) keepmask &= 0xf0; // not no odd
+    }
+    return keepmask;
+  }
+
+  // keep masks indexed by (no even, no odd, FG only) << 8 | source byte
+  var blitKeepMasks = new Uint8Array(8*256);
+  for (var ii=0; ii<8*256; ii++)
+    blitKeepMasks[ii] = blitKeepMask(((ii>>8)&3)<<6 | ((ii>>10)&1)<<3, ii&0xff);
+
   function doBlit(flags) {
     //console.log(hex(flags), blitregs);
     flags &= 0xff;
-    var offs = SCREEN_HEIGHT - blitregs[7];
     var sstart = (blitregs[2] << 8) + blitregs[3];
     var dstart = (blitregs[4] << 8) + blitregs[5];
     var w = blitregs[6] ^ 4; // blitter bug fix
@@ -207,17 +250,38 @@ var WilliamsPlatform = function(mainElement, proto) {
     var syinc = (flags & 0x1) ? 1 : w;
     var dxinc = (flags & 0x2) ? 256 : 1;
     var dyinc = (flags & 0x2) ? 1 : w;
+    var shift = (flags & 0x20) != 0;
+    var keeps = ((flags>>6) | ((flags&0x8)>>1)) << 8;
+    var solid = (flags & 0x10) ? blitregs[1] : -1;
+    // no masking: copy or fill without reading the dest
+    var opaque = (flags & 0xc8) == 0;
+    var mem = ram.mem;
     var pixdata = 0;
     for (var y = 0; y < h; y++) {
       var source = sstart & 0xffff;
       var dest = dstart & 0xffff;
       for (var x = 0; x < w; x++) {
-        var data = memread_williams(source);
-        if (flags & 0x20) {
+        var data;
+        if (source < 0x9000)
+          data = banksel ? rom[source] : mem[source];
+        else if (source < 0xc000)
+          data = mem[source];
+        else
+          data = memread_williams(source);
+        if (shift) {
           pixdata = (pixdata << 8) | data;
-          blit_pixel(dest, (pixdata >> 4) & 0xff, flags);
-        } else {
-          blit_pixel(dest, data, flags);
+          data = (pixdata >> 4) & 0xff;
+        }
+        if (dest < 0x9800) { // can cause recursion otherwise
+          var curpix;
+          if (opaque) {
+            curpix = solid < 0 ? data : solid;
+          } else {
+            var keepmask = blitKeepMasks[keeps + data];
+            curpix = (mem[dest] & keepmask) | ((solid < 0 ? data : solid) & ~keepmask);
+          }
+          mem[dest] = curpix;
+          drawDisplayByte(dest, curpix);
         }
         source += sxinc;
         source &= 0xffff;
@@ -236,31 +300,6 @@ var WilliamsPlatform = function(mainElement, proto) {
     return w * h * (2 + ((flags&0x4)>>2)); // # of memory accesses
   }
 
-  function blit_pixel(dstaddr, srcdata, flags) {
-    var curpix = dstaddr < 0xc000 ? ram.mem[dstaddr] : memread_williams(dstaddr);
-    var solid = blitregs[1];
-    var keepmask = 0xff;          //what part of original dst byte should be kept, based on NO_EVEN and NO_ODD flags
-    //even pixel (D7-D4)
-    if((flags & 0x8) && !(srcdata & 0xf0)) {   //FG only and src even pixel=0
-        if(flags & 0x80) keepmask &= 0x0f; // no even
-    } else {
-        if(!(flags & 0x80)) keepmask &= 0x0f; // not no even
-    }
-    //odd pixel (D3-D0)
-    if((flags & 0x8) && !(srcdata & 0x0f)) {   //FG only and src odd pixel=0
-        if(flags & 0x40) keepmask &= 0xf0; // no odd
-    } else {
-        if(!(flags & 0x40)) keepmask &= 0xf0; // not no odd
-    }
-    curpix &= keepmask;
-    if(flags & 0x10) // solid bit
-      curpix |= (solid & ~keepmask);
-    else
-      curpix |= (srcdata & ~keepmask);
-    if (dstaddr < 0x9800) // can cause recursion otherwise
-      memwrite_williams(dstaddr, curpix);
-  }
-
 // TODO
 /*
   var trace = false;
@@ -277,7 +316,6 @@ var WilliamsPlatform = function(mainElement, proto) {
     ram = new RAM(0xc000);
     nvram = new RAM(0x400);
     // TODO: save in browser storage?
-    //displayPCs = new Uint16Array(new ArrayBuffer(0x9800*2));
     //rom = padBytes(new lzgmini().decode(ROBOTRON_ROM).slice(0), 0xc001);
     membus = {
       read: memread_williams,
@@ -301,7 +339,7 @@ var WilliamsPlatform = function(mainElement, proto) {
 			var x = Math.floor(e.offsetX * video.canvas.width / $(video.canvas).width());
 			var y = Math.floor(e.offsetY * video.canvas.height / $(video.canvas).height());
 			var addr = (x>>3) + (y*32) + 0x400;
-      if (displayPCs)	console.log(x, y, hex(addr,4), "PC", hex(displayPCs[addr],4));
+      if (self.instrumentation) console.log(x, y, hex(addr,4), "PC", hex(self.instrumentation.lastWriterPC[addr],4));
 		});
     var idata = video.getFrameData();
     setKeyboardFromMap(video, pia6821, ROBOTRON_KEYCODE_MAP);
@@ -311,6 +349,7 @@ var WilliamsPlatform = function(mainElement, proto) {
 
   this.advance = function(novideo:boolean) {
     var cpuCyclesPerSection = Math.round(cpuCyclesPerFrame / 65);
+    frameStartClock = cpu.getTstates();
     for (var sl=0; sl<256; sl+=4) {
       video_counter = sl;
       // interrupts happen every 1/4 of the screen
@@ -323,15 +362,14 @@ var WilliamsPlatform = function(mainElement, proto) {
         }
       }
       this.runCPU(cpu, cpuCyclesPerSection);
-      if (sl < 256) video.updateFrame(0, 0, 256-4-sl, 0, 4, 304);
+      if (sl < 256 && !novideo) video.updateFrame(0, 0, 256-4-sl, 0, 4, 304);
     }
     // last 6 lines
     this.runCPU(cpu, cpuCyclesPerSection*2);
-    if (screenNeedsRefresh && !novideo) {
-      for (var i=0; i<0x9800; i++)
-        drawDisplayByte(i, ram.mem[i]);
-      screenNeedsRefresh = false;
-    }
+    // sound CPU runs one frame behind, in step with ours
+    workerchannel.endFrame(cpu.getTstates() - frameStartClock);
+    if (screenNeedsRefresh && !novideo)
+      redrawScreen();
     if (watchdog_counter-- <= 0) {
       console.log("WATCHDOG FIRED, PC =", cpu.getPC().toString(16)); // TODO: alert on video
       // TODO: this.breakpointHit(cpu.T());
@@ -361,6 +399,14 @@ var WilliamsPlatform = function(mainElement, proto) {
 
   this.loadState = function(state) {
     cpu.loadState(state.c);
+    // pixels are drawn at write time, so repaint the bytes the state changes
+    var repaint = screenNeedsRefresh || palette.join() != state.pal.join();
+    palette = state.pal.slice(0);
+    if (!repaint) {
+      for (var i=0; i<0x9800; i++)
+        if (ram.mem[i] != state.b[i])
+          drawDisplayByte(i, state.b[i]);
+    }
     ram.mem.set(state.b);
     nvram.mem.set(state.nvram);
     pia6821.set(state.pia);
@@ -368,6 +414,9 @@ var WilliamsPlatform = function(mainElement, proto) {
     watchdog_counter = state.wdc;
     banksel = state.bs;
     portsel = state.ps;
+    updateCodeCache();
+    if (repaint)
+      redrawScreen();
   }
   this.saveState = function() {
     return {
@@ -379,6 +428,7 @@ var WilliamsPlatform = function(mainElement, proto) {
       wdc:watchdog_counter,
       bs:banksel,
       ps:portsel,
+      pal:palette.slice(0),
     };
   }
   this.loadControlsState = function(state) {
@@ -408,6 +458,7 @@ var WilliamsPlatform = function(mainElement, proto) {
     cpu.reset();
     watchdog_counter = INITIAL_WATCHDOG;
     banksel = 1;
+    updateCodeCache();
   }
   this.scaleCPUFrequency = function(scale) {
     cpuScale = scale;
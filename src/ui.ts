@@ -215,6 +215,11 @@ function refreshWindowList() {
       return new Views.VRAMMemoryView();
     });
   }
+  if (platform.startInstrumentation && platform.getProbe && platform.getProbe()) {
+    addWindowItem("#memheat", "Memory Heatmap", () => {
+      return new Views.MemoryHeatmapView();
+    });
+  }
   if (current_project.segments) {
     addWindowItem("#memmap", "Memory Map", () => {
       return new Views.MemoryMapView();
@@ -225,6 +230,11 @@ function refreshWindowList() {
       return new Views.ProfileView();
     });
   }
+  if (platform.startSampling) {
+    addWindowItem("#sampler", "Sampling Profiler", () => {
+      return new Views.SamplingProfileView();
+    });
+  }
   addWindowItem('#asseteditor', 'Asset Editor', () => {
     return new Views.AssetEditorView();
   });
@@ -1191,6 +1201,25 @@ function traceTiming() {
   }
 }
 
+var turboTimer = null;
+
+// fast forward as fast as the host allows, showing the measured rate in the tooltip
+function toggleTurbo() {
+  var btn = $("#dbg_turbo");
+  if (platform.getTurbo()) {
+    platform.setTurbo(0);
+    btn.removeClass("btn_turbo").attr('title', 'Fast Forward');
+    clearInterval(turboTimer);
+    turboTimer = null;
+  } else {
+    platform.setTurbo(-1);
+    btn.addClass("btn_turbo");
+    turboTimer = setInterval(() => {
+      btn.attr('title', 'Fast Forward (' + platform.getEmulatedFrameRate().toFixed(0) + ' fps)');
+    }, 1000);
+  }
+}
+
 function _disableRecording() {
   if (recorderActive) {
     platform.setRecorder(null);
@@ -1298,6 +1327,9 @@ function setupDebugControls() {
   if (platform.stepBack) {
     uitoolbar.add('ctrl+alt+b', 'Step Backwards', 'glyphicon-step-backward', runStepBackwards).prop('id','dbg_stepback');
   }
+  if (platform.setTurbo) {
+    uitoolbar.add('ctrl+alt+f', 'Fast Forward', 'glyphicon-fast-forward', toggleTurbo).prop('id','dbg_turbo');
+  }
   uitoolbar.newGroup();
   if (platform.newCodeAnalyzer) {
     uitoolbar.add(null, 'Analyze CPU Timing', 'glyphicon-time', traceTiming);
@@ -1541,6 +1573,19 @@ function addPageFocusHandlers() {
   });
 }
 
+// run-ahead frames, per platform: ?runahead=N (remembered, 0 turns it off)
+function setupRunAhead() {
+  if (!platform.setRunAhead) return;
+  var key = "__runahead_" + platform_id;
+  var frames = qs['runahead'];
+  if (frames != null) {
+    if (hasLocalStorage) localStorage.setItem(key, frames);
+  } else if (hasLocalStorage) {
+    frames = localStorage.getItem(key);
+  }
+  if (frames) platform.setRunAhead(parseInt(frames));
+}
+
 function startPlatform() {
   if (!PLATFORMS[platform_id]) throw Error("Invalid platform '" + platform_id + "'.");
   platform = new PLATFORMS[platform_id]($("#emulator")[0]);
@@ -1561,6 +1606,7 @@ function startPlatform() {
   // start platform and load file
   replaceURLState();
   platform.start();
+  setupRunAhead();
   loadBIOSFromProject();
   initProject();
   loadProject(qs['file']);
@@ -3,12 +3,13 @@
 import $ = require("jquery");
 //import CodeMirror = require("codemirror");
 import { SourceFile, WorkerError, Segment, FileData } from "./workertypes";
-import { Platform, EmuState, ProfilerOutput, lookupSymbol } from "./baseplatform";
+import { Platform, EmuState, ProfilerOutput, SamplingProfiler, MemoryInstrumentation, lookupSymbol } from "./baseplatform";
 import { hex, lpad, rpad, safeident, rgb2bgr } from "./util";
 import { CodeAnalyzer } from "./analysis";
 import { platform, platform_id, compparams, current_project, lastDebugState, projectWindows } from "./ui";
 import * as pixed from "./pixed/pixeleditor";
 declare var Mousetrap;
+declare var saveAs;
 
 export interface ProjectView {
   createDiv(parent:HTMLElement, text:string) : HTMLElement;
@@ -548,13 +549,12 @@ export class MemoryView implements ProjectView {
       itemHeight: getVisibleEditorLineHeight(),
       totalRows: 0x2000,
       generatorFn: (row : number) => {
-        var s = this.getMemoryLineAt(row);
         var linediv = document.createElement("div");
         if (this.dumplines) {
           var dlr = this.dumplines[row];
           if (dlr) linediv.classList.add('seg_' + this.getMemorySegment(this.dumplines[row].a));
         }
-        linediv.appendChild(document.createTextNode(s));
+        this.updateMemoryLine($(linediv), row);
         return linediv;
       }
     });
@@ -578,30 +578,36 @@ export class MemoryView implements ProjectView {
       $(this.maindiv).find('[data-index]').each( (i,e) => {
         var div = $(e);
         var row = parseInt(div.attr('data-index'));
-        var oldtext = div.text();
-        var newtext = this.getMemoryLineAt(row);
-        if (oldtext != newtext)
-          div.text(newtext);
+        this.updateMemoryLine(div, row);
       });
     }
   }
 
-  getMemoryLineAt(row : number) : string {
-    var offset = row * 16;
-    var n1 = 0;
-    var n2 = 16;
-    var sym;
+  updateMemoryLine(div : JQuery, row : number) {
+    var oldtext = div.text();
+    var newtext = this.getMemoryLineAt(row);
+    if (oldtext != newtext)
+      div.text(newtext);
+  }
+
+  // address range and symbol shown on a row, or null
+  getMemoryLineRange(row : number) : {offset:number, n1:number, n2:number, sym:string} {
     if (this.getDumpLines()) {
       var dl = this.dumplines[row];
-      if (dl) {
-        offset = dl.a & 0xfff0;
-        n1 = dl.a - offset;
-        n2 = n1 + dl.l;
-        sym = dl.s;
-      } else {
-        return '.';
-      }
+      if (!dl) return null;
+      var offset = dl.a & 0xfff0;
+      return {offset:offset, n1:dl.a - offset, n2:dl.a - offset + dl.l, sym:dl.s};
     }
+    return {offset:row * 16, n1:0, n2:16, sym:null};
+  }
+
+  getMemoryLineAt(row : number) : string {
+    var range = this.getMemoryLineRange(row);
+    if (!range) return '.';
+    var offset = range.offset;
+    var n1 = range.n1;
+    var n2 = range.n2;
+    var sym = range.sym;
     var s = hex(offset+n1,4) + ' ';
     for (var i=0; i<n1; i++) s += '   ';
     if (n1 > 8) s += ' ';
@@ -701,6 +707,90 @@ export class VRAMMemoryView extends MemoryView {
 
 ///
 
+// memory dump colored by access counts: red = writes, green = reads, blue = executes
+const HEATMAP_MSEC = 250;
+
+export class MemoryHeatmapView extends MemoryView {
+  inst : MemoryInstrumentation;
+  scale = 1;
+  scaleMax = 0;
+  lastUpdate = 0;
+
+  setVisible(showing : boolean) : void {
+    if (showing)
+      this.inst = platform.startInstrumentation();
+    else
+      platform.stopInstrumentation();
+  }
+
+  refresh() {
+    this.lastUpdate = this.scaleMax = 0;
+    super.refresh();
+  }
+
+  // repaint a few times a second, and only the rows accessed since
+  tick() {
+    if (!this.inst || !this.memorylist) {
+      super.tick();
+      return;
+    }
+    var now = Date.now();
+    if (now - this.lastUpdate < HEATMAP_MSEC) return;
+    this.lastUpdate = now;
+    // normalize against the busiest address, rounded up to a power of 2
+    // so the colors only shift (and need a full repaint) now and then
+    var max = 1;
+    while (max < this.inst.max) max *= 2;
+    var full = max != this.scaleMax;
+    if (full) {
+      this.scaleMax = max;
+      this.scale = 255 / Math.log(1 + max);
+    }
+    var dirty = this.inst.dirtyRows;
+    $(this.maindiv).find('[data-index]').each( (i,e) => {
+      var div = $(e);
+      var row = parseInt(div.attr('data-index'));
+      var range = this.getMemoryLineRange(row);
+      if (full || !range || dirty[(range.offset >> 4) & 0xfff])
+        this.updateMemoryLine(div, row);
+    });
+    dirty.fill(0); // rows scrolled into view later are drawn from scratch
+  }
+
+  heat(n : number) : number {
+    return Math.round(Math.log(1 + n) * this.scale);
+  }
+
+  updateMemoryLine(div : JQuery, row : number) {
+    var range = this.getMemoryLineRange(row);
+    if (!range || !this.inst) {
+      super.updateMemoryLine(div, row);
+      return;
+    }
+    div.empty();
+    div.append(document.createTextNode(hex(range.offset+range.n1,4) + ' '));
+    for (var i=0; i<16; i++) {
+      var a = range.offset + i;
+      if (i == 8) div.append(document.createTextNode(' '));
+      if (i < range.n1 || i >= range.n2) {
+        div.append(document.createTextNode('   '));
+        continue;
+      }
+      var read = this.readAddress(a);
+      var span = createTextSpan(' ' + (read!==null?hex(read,2):'??'), "");
+      var r = this.heat(this.inst.writes[a]);
+      var g = this.heat(this.inst.reads[a]);
+      var b = this.heat(this.inst.execs[a]);
+      if (r|g|b) span.style.backgroundColor = "rgb(" + r + "," + g + "," + b + ")";
+      var pc = this.inst.lastWriterPC[a];
+      span.title = "R " + this.inst.reads[a] + " W " + this.inst.writes[a] + " X " + this.inst.execs[a]
+        + " overwritten " + this.inst.overwrites[a] + (pc >= 0 ? " last write @ $" + hex(pc,4) : "");
+      div.append(span);
+    }
+    if (range.sym) div.append(document.createTextNode('  ' + range.sym));
+  }
+}
+
 export class BinaryFileView implements ProjectView {
   memorylist;
   maindiv : HTMLElement;
@@ -904,6 +994,104 @@ export class ProfileView implements ProjectView {
 
 ///
 
+const SAMPLE_PROFILE_ROWS = 40;
+const SAMPLE_PROFILE_MSEC = 1000;
+
+export class SamplingProfileView implements ProjectView {
+  maindiv : JQuery;
+  textdiv : JQuery;
+  profiler : SamplingProfiler;
+  lastUpdate = 0;
+
+  createDiv(parent : HTMLElement) {
+    this.maindiv = newDiv(parent, 'vertical-scroll');
+    var toolbar = $('<div/>').appendTo(this.maindiv);
+    $('<button class="btn">Reset</button>').appendTo(toolbar).click(() => {
+      this.profiler = platform.startSampling();
+      this.refresh();
+    });
+    $('<button class="btn">Export Stacks</button>').appendTo(toolbar).click(() => {
+      if (!this.profiler) return;
+      var addr2symbol = platform.debugSymbols && platform.debugSymbols.addr2symbol;
+      var blob = new Blob([this.profiler.getCollapsedStacks(addr2symbol)], {type: "text/plain"});
+      saveAs(blob, current_project.mainPath + ".folded");
+    });
+    this.textdiv = $('<pre class="profiler"/>').appendTo(this.maindiv);
+    return this.maindiv[0];
+  }
+
+  // cycles per source line, over all listings
+  getLineProfile() : {name:string, cycles:number}[] {
+    var totals = {};
+    var listings = current_project.getListings();
+    var pccycles = this.profiler.pccycles;
+    for (var lstfn in listings) {
+      var sourcefile = listings[lstfn].sourcefile;
+      if (!sourcefile) continue;
+      var pc2line = this.getLineMap(lstfn, sourcefile);
+      for (var pc=0; pc<0x10000; pc++) {
+        if (!pccycles[pc]) continue;
+        var line = pc2line[pc];
+        if (line) {
+          var key = lstfn + ":" + line;
+          totals[key] = (totals[key] || 0) + pccycles[pc];
+        }
+      }
+    }
+    var result = Object.keys(totals).map((name) => { return {name:name, cycles:totals[name]}; });
+    result.sort((a,b) => { return b.cycles - a.cycles; });
+    return result;
+  }
+
+  // PC -> line for each listing, rebuilt when it's recompiled
+  linemaps : {[lstfn:string] : {sourcefile:SourceFile, pc2line:Int32Array}} = {};
+
+  getLineMap(lstfn:string, sourcefile:SourceFile) : Int32Array {
+    var lm = this.linemaps[lstfn];
+    if (!lm || lm.sourcefile !== sourcefile) {
+      var pc2line = new Int32Array(0x10000);
+      for (var pc=0; pc<0x10000; pc++)
+        pc2line[pc] = sourcefile.findLineForOffset(pc, 15) || 0;
+      lm = this.linemaps[lstfn] = {sourcefile:sourcefile, pc2line:pc2line};
+    }
+    return lm.pc2line;
+  }
+
+  formatRows(title:string, rows:{name:string, cycles:number}[]) : string {
+    var total = this.profiler.totalcycles || 1;
+    var s = title + "\n";
+    for (var row of rows.slice(0, SAMPLE_PROFILE_ROWS)) {
+      s += lpad((row.cycles*100/total).toFixed(1),6) + "% " + lpad(row.cycles+"",10) + "  " + row.name + "\n";
+    }
+    return s + "\n";
+  }
+
+  refresh() {
+    this.lastUpdate = 0;
+    this.tick();
+  }
+
+  tick() {
+    if (!this.profiler) return;
+    // tables change slowly, so only rebuild them about once a second
+    var now = Date.now();
+    if (now - this.lastUpdate < SAMPLE_PROFILE_MSEC) return;
+    this.lastUpdate = now;
+    var addr2symbol = platform.debugSymbols && platform.debugSymbols.addr2symbol;
+    var flat = this.profiler.getFlatProfile(addr2symbol);
+    this.textdiv.text(this.formatRows("Cycles by symbol", flat) + this.formatRows("Cycles by line", this.getLineProfile()));
+  }
+
+  setVisible(showing : boolean) : void {
+    if (showing)
+      this.profiler = platform.startSampling();
+    else
+      platform.stopSampling();
+  }
+}
+
+///
+
 export class AssetEditorView implements ProjectView, pixed.EditorContext {
   maindiv : JQuery;
   cureditordiv : JQuery;
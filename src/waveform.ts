@@ -10,7 +10,441 @@ export interface WaveformMeta {
 
 export interface WaveformProvider {
   getSignalMetadata() : WaveformMeta[];
-  getSignalData(index:number, start:number, len:number) : number[];
+  getSignalData(index:number, start:number, len:number) : ArrayLike<number>;
+  getSignalMinMax?(index:number, start:number, step:number, mins:Uint32Array, maxs:Uint32Array) : number;
+  getFirstTime?() : number;
+}
+
+// columnar ring buffer of signal samples, one Uint32Array per signal
+// with a min/max pyramid (built lazily) for zoomed-out rendering
+
+const PYRAMID_SHIFT = 4; // 16 samples per block at each level
+const PYRAMID_MAX_LEVELS = 4;
+
+type PyramidLevel = {
+  shift : number;
+  mins : Uint32Array[];
+  maxs : Uint32Array[];
+  valid : number; // blocks < valid are computed
+};
+
+export class WaveformTraceBuffer {
+  nsignals : number;
+  capacity : number; // samples per signal (power of 2)
+  mask : number;
+  columns : Uint32Array[] = [];
+  total : number = 0; // number of samples appended since clear()
+  scratch : Uint32Array;
+  levels : PyramidLevel[] = [];
+
+  constructor(nsignals:number, maxwords:number) {
+    this.nsignals = nsignals;
+    var cap = 1 << PYRAMID_SHIFT;
+    while (cap*2*Math.max(1,nsignals) <= maxwords)
+      cap *= 2;
+    this.capacity = cap;
+    this.mask = cap-1;
+    for (var i=0; i<nsignals; i++)
+      this.columns.push(new Uint32Array(cap));
+    this.scratch = new Uint32Array(cap);
+    for (var shift=PYRAMID_SHIFT; shift<=PYRAMID_SHIFT*PYRAMID_MAX_LEVELS && (cap>>shift) > 0; shift+=PYRAMID_SHIFT) {
+      var lvl = {shift:shift, mins:[], maxs:[], valid:0};
+      for (var i=0; i<nsignals; i++) {
+        lvl.mins.push(new Uint32Array(cap>>shift));
+        lvl.maxs.push(new Uint32Array(cap>>shift));
+      }
+      this.levels.push(lvl);
+    }
+  }
+
+  clear() {
+    this.total = 0;
+    for (var lvl of this.levels)
+      lvl.valid = 0;
+  }
+
+  // time of oldest sample still in buffer
+  getFirstTime() : number {
+    return Math.max(0, this.total - this.capacity);
+  }
+
+  isFull() : boolean {
+    return this.total >= this.capacity;
+  }
+
+  // append one sample for every signal, from src[ofs..ofs+nsignals-1]
+  append(src:ArrayLike<number>, ofs:number) {
+    var pos = this.total & this.mask;
+    var cols = this.columns;
+    for (var i=0; i<cols.length; i++)
+      cols[i][pos] = src[ofs+i];
+    this.total++;
+  }
+
+  // returns a view of samples [start, start+len) if contiguous in the ring, otherwise a copy
+  getSlice(index:number, start:number, len:number) : Uint32Array {
+    var col = this.columns[index];
+    start = Math.max(start, this.getFirstTime());
+    len = Math.min(len, this.total - start);
+    if (len <= 0) return col.subarray(0, 0);
+    var pos = start & this.mask;
+    if (pos + len <= this.capacity)
+      return col.subarray(pos, pos + len);
+    var n = this.capacity - pos;
+    this.scratch.set(col.subarray(pos), 0);
+    this.scratch.set(col.subarray(0, len - n), n);
+    return this.scratch.subarray(0, len);
+  }
+
+  updatePyramid() {
+    var first = this.getFirstTime();
+    for (var k=0; k<this.levels.length; k++) {
+      var lvl = this.levels[k];
+      var bs = 1 << lvl.shift;
+      var nblocks = this.capacity >> lvl.shift;
+      var end = Math.floor(this.total / bs);
+      var b = Math.max(lvl.valid, Math.ceil(first / bs));
+      for (; b<end; b++) {
+        var slot = b & (nblocks-1);
+        for (var i=0; i<this.nsignals; i++) {
+          var lo = 0xffffffff;
+          var hi = 0;
+          if (k == 0) {
+            var col = this.columns[i];
+            var pos = (b << lvl.shift) & this.mask;
+            for (var j=0; j<bs; j++) {
+              var v = col[pos+j];
+              if (v < lo) lo = v;
+              if (v > hi) hi = v;
+            }
+          } else {
+            var prev = this.levels[k-1];
+            var pmask = (this.capacity >> prev.shift) - 1;
+            var child = b << PYRAMID_SHIFT;
+            for (var j=0; j<(1<<PYRAMID_SHIFT); j++) {
+              var cs = (child+j) & pmask;
+              if (prev.mins[i][cs] < lo) lo = prev.mins[i][cs];
+              if (prev.maxs[i][cs] > hi) hi = prev.maxs[i][cs];
+            }
+          }
+          lvl.mins[i][slot] = lo;
+          lvl.maxs[i][slot] = hi;
+        }
+      }
+      lvl.valid = end;
+    }
+  }
+
+  // compute min/max for each pixel covering [start+p*step, start+(p+1)*step)
+  // using the coarsest pyramid blocks that fit, returns number of pixels filled
+  // (pixels without samples get min > max)
+  getMinMax(index:number, start:number, step:number, mins:Uint32Array, maxs:Uint32Array) : number {
+    this.updatePyramid();
+    var col = this.columns[index];
+    var first = this.getFirstTime();
+    var n = 0;
+    for (var p=0; p<mins.length; p++) {
+      var t = Math.max(first, Math.floor(start + p*step));
+      var t1 = Math.min(this.total, Math.floor(start + (p+1)*step));
+      if (t >= this.total) break;
+      var lo = 0xffffffff; // lo > hi means no samples
+      var hi = 0;
+      while (t < t1) {
+        var k = this.levels.length-1;
+        for (; k>=0; k--) {
+          var lvl = this.levels[k];
+          var bs = 1 << lvl.shift;
+          if ((t & (bs-1)) == 0 && t+bs <= t1 && (t >> lvl.shift) < lvl.valid)
+            break;
+        }
+        if (k >= 0) {
+          var slot = (t >> lvl.shift) & ((this.capacity >> lvl.shift) - 1);
+          if (lvl.mins[index][slot] < lo) lo = lvl.mins[index][slot];
+          if (lvl.maxs[index][slot] > hi) hi = lvl.maxs[index][slot];
+          t += bs;
+        } else {
+          var v = col[t & this.mask];
+          if (v < lo) lo = v;
+          if (v > hi) hi = v;
+          t++;
+        }
+      }
+      mins[p] = lo;
+      maxs[p] = hi;
+      n = p+1;
+    }
+    return n;
+  }
+}
+
+/// VCD (Value Change Dump) export/import
+
+const VCD_CHUNK_SIZE = 0x10000;
+
+// streams value changes to a sink in chunks, so long runs don't have to fit in memory
+export class VCDWriter {
+  sink : (s:string) => void;
+  meta : WaveformMeta[];
+  ids : string[] = [];
+  last : Uint32Array;
+  lasttime : number = -1;
+  buf : string[] = [];
+  buflen : number = 0;
+
+  constructor(meta:WaveformMeta[], sink:(s:string) => void) {
+    this.meta = meta;
+    this.sink = sink;
+    this.last = new Uint32Array(meta.length);
+    for (var i=0; i<meta.length; i++) {
+      // short identifier from printable characters
+      var id = "";
+      var n = i;
+      do {
+        id += String.fromCharCode(33 + n % 94);
+        n = Math.floor(n / 94);
+      } while (n > 0);
+      this.ids.push(id);
+    }
+  }
+
+  writeHeader(scope:string, timescale:string) {
+    this.put("$timescale " + timescale + " $end\n");
+    this.put("$scope module " + scope + " $end\n");
+    for (var i=0; i<this.meta.length; i++) {
+      var m = this.meta[i];
+      this.put("$var wire " + m.len + " " + this.ids[i] + " " + m.label + " $end\n");
+    }
+    this.put("$upscope $end\n$enddefinitions $end\n");
+  }
+
+  formatValue(index:number, val:number) : string {
+    if (this.meta[index].len == 1)
+      return (val & 1) + this.ids[index] + "\n";
+    else
+      return "b" + (val>>>0).toString(2) + " " + this.ids[index] + "\n";
+  }
+
+  // write values[ofs..ofs+n-1] at the given time, only those that changed
+  writeSample(time:number, values:ArrayLike<number>, ofs:number) {
+    var first = this.lasttime < 0;
+    var s = "";
+    for (var i=0; i<this.meta.length; i++) {
+      var v = values[ofs+i] >>> 0;
+      if (first || v != this.last[i]) {
+        s += this.formatValue(i, v);
+        this.last[i] = v;
+      }
+    }
+    if (first)
+      this.put("#" + time + "\n$dumpvars\n" + s + "$end\n");
+    else if (s.length)
+      this.put("#" + time + "\n" + s);
+    this.lasttime = time;
+  }
+
+  put(s:string) {
+    this.buf.push(s);
+    this.buflen += s.length;
+    if (this.buflen >= VCD_CHUNK_SIZE)
+      this.flush();
+  }
+
+  flush() {
+    if (this.buflen) {
+      this.sink(this.buf.join(""));
+      this.buf = [];
+      this.buflen = 0;
+    }
+  }
+
+  close(endtime?:number) {
+    if (endtime > this.lasttime)
+      this.put("#" + endtime + "\n");
+    this.flush();
+  }
+}
+
+type VCDCheckpoint = {
+  time : number;    // values in effect just before this time's changes
+  offset : number;  // offset of "#time" line
+  values : Uint32Array;
+};
+
+const VCD_CHECKPOINT_INTERVAL = 0x1000;
+const VCD_MIN_WINDOW = 0x1000;
+
+// reads a VCD file in chunks through a read(offset,len) callback,
+// indexing it once and decoding time windows on demand for WaveformView
+export class VCDReader implements WaveformProvider {
+  read : (offset:number, len:number) => string;
+  size : number;
+  meta : WaveformMeta[] = [];
+  id2index : {[id:string]:number} = {};
+  checkpoints : VCDCheckpoint[] = [];
+  bodyOffset : number = 0;
+  endTime : number = 0;
+  // last decoded window
+  wstart : number = -1;
+  wlen : number = 0;
+  columns : Uint32Array[];
+
+  constructor(read:(offset:number, len:number) => string, size:number) {
+    this.read = read;
+    this.size = size;
+    this.parseHeader();
+    this.buildIndex();
+  }
+
+  // call fn for each line starting at offset, until it returns false
+  scanLines(offset:number, fn:(line:string, offset:number) => boolean) {
+    var rem = "";
+    var remofs = offset;
+    while (offset < this.size) {
+      var chunk = rem + this.read(offset, Math.min(VCD_CHUNK_SIZE, this.size - offset));
+      offset += chunk.length - rem.length;
+      var lines = chunk.split("\n");
+      rem = offset < this.size ? lines.pop() : "";
+      var ofs = remofs;
+      for (var line of lines) {
+        if (fn(line, ofs) === false) return;
+        ofs += line.length + 1;
+      }
+      remofs = ofs;
+    }
+    if (rem.length) fn(rem, remofs);
+  }
+
+  parseHeader() {
+    var scopes = [];
+    this.scanLines(0, (line, ofs) => {
+      var toks = line.trim().split(/\s+/);
+      switch (toks[0]) {
+        case '$scope':
+          scopes.push(toks[2]);
+          break;
+        case '$upscope':
+          scopes.pop();
+          break;
+        case '$var':
+          // $var wire 8 ! name $end
+          var len = parseInt(toks[2]);
+          var id = toks[3];
+          if (this.id2index[id] === undefined) {
+            this.id2index[id] = this.meta.length;
+            this.meta.push({label:scopes.slice(1).concat([toks[4]]).join('.'), len:len});
+          }
+          break;
+        case '$enddefinitions':
+          this.bodyOffset = ofs + line.length + 1;
+          return false;
+      }
+      return true;
+    });
+  }
+
+  // apply a value change line to values, returns false if not a value change
+  parseValueChange(line:string, values:Uint32Array) : boolean {
+    var ch = line.charAt(0);
+    var id, val;
+    if (ch == 'b' || ch == 'B') {
+      var sp = line.indexOf(' ');
+      val = parseInt(line.substring(1, sp).replace(/[xzXZ]/g, '0'), 2) || 0;
+      id = line.substring(sp+1).trim();
+    } else if (ch == 'r' || ch == 'R') {
+      var sp = line.indexOf(' ');
+      val = parseFloat(line.substring(1, sp)) || 0;
+      id = line.substring(sp+1).trim();
+    } else if (ch == '0' || ch == '1' || ch == 'x' || ch == 'X' || ch == 'z' || ch == 'Z') {
+      val = ch == '1' ? 1 : 0;
+      id = line.substring(1).trim();
+    } else {
+      return false;
+    }
+    var index = this.id2index[id];
+    if (index !== undefined)
+      values[index] = val;
+    return true;
+  }
+
+  buildIndex() {
+    var values = new Uint32Array(this.meta.length);
+    var nextcp = 0;
+    var curtime = 0;
+    this.scanLines(this.bodyOffset, (line, ofs) => {
+      if (line.charAt(0) == '#') {
+        var t = parseInt(line.substring(1));
+        if (t >= nextcp) {
+          this.checkpoints.push({time:t, offset:ofs, values:values.slice(0)});
+          nextcp = t + VCD_CHECKPOINT_INTERVAL;
+        }
+        this.endTime = Math.max(this.endTime, t);
+        curtime = t;
+      } else if (this.parseValueChange(line, values)) {
+        this.endTime = Math.max(this.endTime, curtime+1);
+      }
+      return true;
+    });
+  }
+
+  findCheckpoint(time:number) : VCDCheckpoint {
+    var lo = 0;
+    var hi = this.checkpoints.length-1;
+    if (hi < 0 || this.checkpoints[0].time > time) return null;
+    while (lo < hi) {
+      var mid = (lo + hi + 1) >> 1;
+      if (this.checkpoints[mid].time <= time) lo = mid; else hi = mid-1;
+    }
+    return this.checkpoints[lo];
+  }
+
+  // decode samples [start, start+len) for all signals
+  decodeWindow(start:number, len:number) {
+    if (!this.meta.length) {
+      this.columns = [];
+      this.wstart = start;
+      this.wlen = 0;
+      return;
+    }
+    if (!this.columns || this.columns[0].length < len) {
+      this.columns = this.meta.map(() => new Uint32Array(len));
+    }
+    var cols = this.columns;
+    var end = Math.min(start + len, this.endTime);
+    var cp = this.findCheckpoint(start);
+    var values = cp ? cp.values.slice(0) : new Uint32Array(this.meta.length);
+    var curtime = cp ? cp.time : 0;
+    var fill = (t1:number) => {
+      for (var t=Math.max(curtime, start); t<Math.min(t1, end); t++)
+        for (var i=0; i<cols.length; i++)
+          cols[i][t-start] = values[i];
+    };
+    this.scanLines(cp ? cp.offset : this.bodyOffset, (line) => {
+      if (line.charAt(0) == '#') {
+        var t = parseInt(line.substring(1));
+        fill(t);
+        curtime = t;
+        return t < end;
+      } else {
+        this.parseValueChange(line, values);
+        return true;
+      }
+    });
+    fill(end);
+    this.wstart = start;
+    this.wlen = Math.max(0, end - start);
+  }
+
+  getSignalMetadata() : WaveformMeta[] {
+    return this.meta;
+  }
+
+  getSignalData(index:number, start:number, len:number) : ArrayLike<number> {
+    len = Math.max(0, Math.min(len, this.endTime - start));
+    if (len == 0) return [];
+    if (start < this.wstart || start + len > this.wstart + this.wlen)
+      this.decodeWindow(start, Math.max(len, VCD_MIN_WINDOW));
+    return this.columns[index].subarray(start - this.wstart, start - this.wstart + len);
+  }
 }
 
 export class WaveformView {
@@ -138,7 +572,7 @@ export class WaveformView {
   
   roundT(t : number) {
     t = Math.round(t);
-    t = Math.max(0, t); // make sure >= 0
+    t = Math.max(this.wfp.getFirstTime ? this.wfp.getFirstTime() : 0, t); // make sure >= first sample
     t = Math.min(this.clockMax + this.clocksPerPage/2, t); // make sure <= end
     return t;
   }
@@ -163,7 +597,8 @@ export class WaveformView {
   }
   
   setZoom(zoom : number) {
-    this.zoom = Math.max(1, Math.min(64, zoom));
+    var minzoom = this.wfp.getSignalMinMax ? 1/4096 : 1;
+    this.zoom = Math.max(minzoom, Math.min(64, zoom));
     this.clocksPerPage = Math.ceil(this.pageWidth/this.zoom); // TODO: refactor into other one
     this.refresh();
   }
@@ -193,6 +628,12 @@ export class WaveformView {
     var b2 = 4;
     var h2 = h-b1-b2;
     var yrange = ((1<<meta.len)-1) || 0;
+    // zoomed out? draw min/max of each pixel
+    if (this.zoom < 1 && this.wfp.getSignalMinMax) {
+      this.refreshRowMinMax(row, ctx, w, b1, h2, yrange);
+      this.drawRowLabel(ctx, meta, fh);
+      return;
+    }
     var data = this.wfp.getSignalData(row, this.t0, Math.ceil(w/this.zoom));
     this.clockMax = Math.max(this.clockMax, this.t0 + data.length);
     var printvals = meta.len > 1 && this.zoom >= 32;
@@ -242,6 +683,39 @@ export class WaveformView {
         ctx.fillText(s, w-fh, ycen);
       }
     }
+    this.drawRowLabel(ctx, meta, fh);
+  }
+
+  minbuf : Uint32Array;
+  maxbuf : Uint32Array;
+
+  refreshRowMinMax(row:number, ctx:CanvasRenderingContext2D, w:number, b1:number, h2:number, yrange:number) {
+    if (!this.minbuf || this.minbuf.length != w) {
+      this.minbuf = new Uint32Array(w);
+      this.maxbuf = new Uint32Array(w);
+    }
+    var step = 1/this.zoom;
+    var n = this.wfp.getSignalMinMax(row, this.t0, step, this.minbuf, this.maxbuf);
+    this.clockMax = Math.max(this.clockMax, Math.floor(this.t0 + n*step));
+    ctx.fillStyle = "#336633";
+    ctx.fillRect(0, 6, 3, b1+h2-6); // draw left tag
+    ctx.fillStyle = "#66ff66";
+    for (var x=0; x<n; x++) {
+      var lo = this.minbuf[x];
+      var hi = this.maxbuf[x];
+      if (lo > hi) continue; // no samples
+      var y0 = b1 + (1.0 - hi/yrange) * h2;
+      var y1 = b1 + (1.0 - lo/yrange) * h2;
+      ctx.fillRect(x, y0, 1, Math.max(1, y1-y0));
+    }
+    // draw selection thingie
+    if (this.tsel >= this.t0) {
+      ctx.fillStyle = "#ff66ff";
+      ctx.fillRect((this.tsel - this.t0)*this.zoom, 0, 1, b1+h2);
+    }
+  }
+
+  drawRowLabel(ctx:CanvasRenderingContext2D, meta:WaveformMeta, fh:number) {
     // draw labels
     ctx.fillStyle = "white";
     ctx.textAlign = "left";
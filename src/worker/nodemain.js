@@ -5,73 +5,123 @@ var assert = require('assert');
 var fs = require('fs');
 var vm = require('vm');
 
-var worker = {};
+// the worker expects a browser-like global environment
+function setupWorkerEnv() {
+  var worker = {};
 
-global.includeInThisContext = function(path) {
-    var code = fs.readFileSync(path);
-    vm.runInThisContext(code, path);
-};
+  global.includeInThisContext = function(path) {
+      var code = fs.readFileSync(path);
+      vm.runInThisContext(code, path);
+  };
 
-global.importScripts = function(path) {
-    includeInThisContext('./'+path);
-}
+  global.importScripts = function(path) {
+      includeInThisContext('./'+path);
+  }
 
-function Blob(blob) {
-  this.size = blob.length;
-  this.length = blob.length;
-  this.slice = function(a,b) {
-    var data = blob.slice(a,b);
-    var b = new Blob(data);
-    return b;
+  function Blob(blob) {
+    this.size = blob.length;
+    this.length = blob.length;
+    this.slice = function(a,b) {
+      var data = blob.slice(a,b);
+      var b = new Blob(data);
+      return b;
+    }
+    this.asArrayBuffer = function() {
+      var buf = new ArrayBuffer(blob.length);
+      var arr = new Uint8Array(buf);
+      for (var i=0; i<blob.length; i++)
+        arr[i] = blob[i].charCodeAt(0);
+      return arr;
+    }
   }
-  this.asArrayBuffer = function() {
-    var buf = new ArrayBuffer(blob.length);
-    var arr = new Uint8Array(buf);
-    for (var i=0; i<blob.length; i++)
-      arr[i] = blob[i].charCodeAt(0);
-    return arr;
+
+  global.XMLHttpRequest = function() {
+      this.open = function(a,b,c) {
+          if (this.responseType == 'json') {
+              var txt = fs.readFileSync('./'+b);
+              this.response = JSON.parse(txt);
+          } else if (this.responseType == 'blob') {
+              var data = fs.readFileSync('./'+b, {encoding:'binary'});
+              this.response = new Blob(data);
+          } else if (this.responseType == 'arraybuffer') {
+              var data = fs.readFileSync('./'+b, {encoding:'binary'});
+              this.response = new Blob(data).asArrayBuffer();
+          } else {
+              throw new Error("responseType " + this.responseType + " not handled");
+          }
+      }
+      this.send = function() { }
   }
-}
 
-global.XMLHttpRequest = function() {
-    this.open = function(a,b,c) {
-        if (this.responseType == 'json') {
-            var txt = fs.readFileSync('./'+b);
-            this.response = JSON.parse(txt);
-        } else if (this.responseType == 'blob') {
-            var data = fs.readFileSync('./'+b, {encoding:'binary'});
-            this.response = new Blob(data);
-        } else if (this.responseType == 'arraybuffer') {
-            var data = fs.readFileSync('./'+b, {encoding:'binary'});
-            this.response = new Blob(data).asArrayBuffer();
-        } else {
-            throw new Error("responseType " + this.responseType + " not handled");
-        }
+  global.FileReaderSync = function() {
+    this.readAsArrayBuffer = function(blob) {
+      return blob.asArrayBuffer();
     }
-    this.send = function() { }
-}
+  }
 
-global.FileReaderSync = function() {
-  this.readAsArrayBuffer = function(blob) {
-    return blob.asArrayBuffer();
+  global.onmessage = null;
+  global.postMessage = null;
+
+  includeInThisContext("./workermain.js");
+
+  global.ab2str = function(buf) {
+    return String.fromCharCode.apply(null, new Uint16Array(buf));
   }
 }
 
-global.onmessage = null;
-global.postMessage = null;
+// verilog.js expects a browser environment
+function loadVerilogPlatform() {
+  var jsdom = require('jsdom');
+  var dom = new jsdom.JSDOM(`<!DOCTYPE html><div id="emulator"></div>`);
+  global.window = dom.window;
+  global.document = dom.window.document;
+  global.navigator = {};
+  global['$'] = require("jquery/jquery-2.2.3.min.js");
+  var verilog = require('../../gen/platform/verilog.js');
+  Object.assign(global, verilog); // copy global VL_* properties
+  return verilog;
+}
 
-includeInThisContext("./workermain.js");
+// run a verilator result headless, streaming its trace to a VCD file
+function writeVCD(verilog, output, path, ncycles) {
+  var fd = fs.openSync(path, 'w');
+  try {
+    var n = verilog.captureVCD(output, ncycles, function(s) { fs.writeSync(fd, s); });
+  } finally {
+    fs.closeSync(fd);
+  }
+  return n;
+}
 
-global.ab2str = function(buf) {
-  return String.fromCharCode.apply(null, new Uint16Array(buf));
+function parseArgs(args) {
+  var opts = {vcdpath:null, ncycles:1000000, files:null};
+  args = args.slice(0);
+  while (args.length > 1 && args[0].startsWith('--')) {
+    var opt = args.shift();
+    if (opt == '--vcd') opts.vcdpath = args.shift();
+    else if (opt == '--cycles') opts.ncycles = parseInt(args.shift());
+    else throw new Error("unknown option " + opt);
+  }
+  opts.files = args;
+  return opts;
 }
 
+module.exports = {
+  parseArgs: parseArgs,
+  writeVCD: writeVCD
+};
+
 if (require.main == module) {
-  var data = fs.readFileSync(process.argv[2]);
+  setupWorkerEnv();
+  var opts = parseArgs(process.argv.slice(2));
+  var data = fs.readFileSync(opts.files[0]);
   var msgs = JSON.parse(data);
+  var lastoutput;
   for (var i=0; i<msgs.length; i++) {
     var result = handleMessage(msgs[i]);
     //console.log(result);
+    if (result && result.output && result.output.code)
+      lastoutput = result.output;
     if (result && result.intermediate) {
       for (var fn in result.intermediate) {
         console.log("==="+fn);
@@ -83,4 +133,9 @@ if (require.main == module) {
         console.log(workfs[fn].data);
     }
   }
+  if (opts.vcdpath) {
+    if (!lastoutput) throw new Error("no verilog output to simulate");
+    var n = writeVCD(loadVerilogPlatform(), lastoutput, opts.vcdpath, opts.ncycles);
+    console.log("wrote " + n + " samples to " + opts.vcdpath);
+  }
 }
@@ -4,7 +4,8 @@ type V2JS_Var = {
   name:string,
   len:number,
   ofs:number,
-  arrdim?:number[]
+  arrdim?:number[],
+  sigidx?:number // index into __sig storage (scalars only)
 }
 
 type V2JS_Code = {
@@ -12,6 +13,7 @@ type V2JS_Code = {
   ports:V2JS_Var[],
   signals:V2JS_Var[],
   funcs:string[],
+  changeDetect:boolean, // does _change_request() watch any signals?
 }
 
 type V2JS_Output = {
@@ -27,6 +29,7 @@ function translateVerilatorOutputToJS(htext:string, cpptext:string) {
 
 var moduleName : string;
 var symsName : string;
+var sigmap : {[name:string]:V2JS_Var};
 
 function parseDecls(text:string, arr:V2JS_Var[], name:string, bin?:boolean, bout?:boolean) {
   var re = new RegExp(name + "(\\d*)[(](\\w+),(\\d+),(\\d+)[)]", 'gm');
@@ -63,24 +66,85 @@ function parseDecls(text:string, arr:V2JS_Var[], name:string, bin?:boolean, bout
   }
 }
 
-function buildModule(o : V2JS_Code) : string {
+// can this signal live in the __sig array? (values > 32 bits are rejected by translateFunction)
+function isScalarSignal(sig : V2JS_Var) : boolean {
+  return !sig.arrdim && !(sig.wordlen > 32);
+}
+
+// lay out scalar ports and signals in a single Int32Array
+// (signed, like the int32 values the translated expressions produce)
+// order is clk, reset, other ports, signals, then internal __V* signals,
+// so that traced signals occupy a contiguous range
+function layoutSignals(ports : V2JS_Var[], signals : V2JS_Var[]) : V2JS_Var[] {
+  var all = ports.concat(signals).filter(isScalarSignal);
+  var rank = (sig : V2JS_Var) => {
+    if (sig.name == 'clk') return 0;
+    if (sig.name == 'reset') return 1;
+    if (sig.name.startsWith('__V')) return 3;
+    return 2;
+  };
+  var sorted = [];
+  for (var r=0; r<=3; r++)
+    sorted = sorted.concat(all.filter((sig) => rank(sig) == r));
+  for (var i=0; i<sorted.length; i++)
+    sorted[i].sigidx = i;
+  return sorted;
+}
+
+function getTypedArrayName(wordlen : number) : string {
+  switch (wordlen) {
+    case 8:  return "Uint8Array";
+    case 16: return "Uint16Array";
+    case 64: return null;
+    default: return "Int32Array"; // VL_SIG has no suffix; signed, like __sig
+  }
+}
+
+// verilator declares a __Vchglast__ shadow for each signal its
+// _change_request() watches; with none, no settle pass is ever requested
+function hasChangeDetection(signals : V2JS_Var[]) : boolean {
+  for (var sig of signals) {
+    if (sig.name.startsWith("__Vchglast__"))
+      return true;
+  }
+  return false;
+}
+
+function buildModule(o : V2JS_Code, layout : V2JS_Var[]) : string {
   var m = '"use strict";\n';
+  // scalar storage, with named accessors for debugger and platform
+  m += "\tvar __sig = this.__sig = new Int32Array(" + layout.length + ");\n";
+  m += "\tvar __signames = " + JSON.stringify(layout.map((sig) => sig.name)) + ";\n";
+  m += "\tfor (var i=0; i<__signames.length; i++) (function(self, i) {\n";
+  m += "\t\tObject.defineProperty(self, __signames[i], {get:function() { return __sig[i]; }, set:function(v) { __sig[i] = v; }});\n";
+  m += "\t})(this, i);\n";
   for (var i=0; i<o.ports.length; i++) {
-    m += "\tthis." + o.ports[i].name + ";\n";
+    if (!isScalarSignal(o.ports[i]))
+      m += "\tthis." + o.ports[i].name + ";\n";
   }
   for (var i=0; i<o.signals.length; i++) {
     var sig = o.signals[i];
+    var arrtype = getTypedArrayName(sig.wordlen);
     if (sig.arrdim) {
       if (sig.arrdim.length == 1) {
-        m += "\tvar " + sig.name + " = this." + sig.name + " = [];\n";
+        if (arrtype)
+          m += "\tvar " + sig.name + " = this." + sig.name + " = new " + arrtype + "(" + sig.arrdim[0] + ");\n";
+        else
+          m += "\tvar " + sig.name + " = this." + sig.name + " = [];\n";
       } else if (sig.arrdim.length == 2) {
         m += "\tvar " + sig.name + " = this." + sig.name + " = [];\n";
-        m += "\tfor(var i=0; i<" + sig.arrdim[0] + "; i++) { " + sig.name + "[i] = []; }\n";
+        if (arrtype)
+          m += "\tfor(var i=0; i<" + sig.arrdim[0] + "; i++) { " + sig.name + "[i] = new " + arrtype + "(" + sig.arrdim[1] + "); }\n";
+        else
+          m += "\tfor(var i=0; i<" + sig.arrdim[0] + "; i++) { " + sig.name + "[i] = []; }\n";
       }
-    } else {
+    } else if (!isScalarSignal(sig)) {
       m += "\tthis." + sig.name + ";\n";
     }
   }
+  // without change detection, eval() can skip its settle loop
+  if (!o.changeDetect)
+    m += "\tthis.__Vm_noFeedback = true;\n";
   for (var i=0; i<o.funcs.length; i++) {
     m += o.funcs[i];
   }
@@ -104,11 +168,91 @@ function getStats(o : V2JS_Code) {
   return {bits:nmembits, lines:nlines};
 }
 
+function matchBracket(text : string, i : number, dir : number) : number {
+  var depth = 0;
+  for (; i >= 0 && i < text.length; i += dir) {
+    var c = text[i];
+    if (c == '(' || c == '[') depth += dir;
+    else if (c == ')' || c == ']') depth -= dir;
+    if (depth == 0) return i;
+  }
+  return -1;
+}
+
+// start of the operand ending at i: a name, call, index or parenthesized group
+// (verilator parenthesizes every binary expression)
+function leftOperand(text : string, i : number) : number {
+  while (i > 0 && text[i-1] == ' ') i--;
+  var j = i;
+  for (;;) {
+    var c = text[j-1];
+    if (c == ')' || c == ']')
+      j = matchBracket(text, j-1, -1);
+    else if (/[\w.$]/.test(c))
+      while (j > 0 && /[\w.$]/.test(text[j-1])) j--;
+    else
+      break;
+    if (j < 0) return -1;
+  }
+  while (j > 0 && (text[j-1] == '~' || text[j-1] == '!')) j--;
+  return j;
+}
+
+// end of the operand starting at i, with any unary prefix
+function rightOperand(text : string, i : number) : number {
+  while (i < text.length && /[ ~!-]/.test(text[i])) i++;
+  var started = false;
+  for (;;) {
+    var c = text[i];
+    if (c == '(' || c == '[') {
+      i = matchBracket(text, i, 1);
+      if (i < 0) return -1;
+      i++;
+    } else if (!started && /[\w.$]/.test(c)) {
+      while (i < text.length && /[\w.$]/.test(text[i])) i++;
+    } else
+      break;
+    started = true;
+  }
+  return i;
+}
+
+// 32-bit values are kept signed, so relational compares and right shifts
+// get unsigned operands: (a < b) => ((a>>>0) < (b>>>0)), (a >> b) => ((a >>> b)|0)
+// except for C++ int locals (loop counters), which stay signed
+function translateUnsignedOps(text : string, ints : {[name:string]:boolean}) : string {
+  // leave strings and comments alone
+  var saved = [];
+  text = text.replace(/"(?:[^"\\\n]|\\.)*"|\/\/[^\n]*|\/\*[^]*?\*\//g, (s) => "__vlsaved" + (saved.push(s)-1) + "__");
+  var re = /<<=?|>>>=?|>>=|>>|[<>]=?/g;
+  var m;
+  while ((m = re.exec(text))) {
+    var op = m[0];
+    if (op[0] == op[1] && op != '>>') continue; // shifts left, >>>, and assignments
+    var l = leftOperand(text, m.index);
+    var r = rightOperand(text, m.index + op.length);
+    if (l < 0 || r < 0) continue;
+    var lhs = text.substring(l, m.index).trim();
+    var rhs = text.substring(m.index + op.length, r).trim();
+    if (ints[lhs] || ints[rhs]) continue;
+    var head = (op == '>>') ? "((" + lhs + " >>> " : "(" + lhs + ">>>0) " + op + " (";
+    var tail = (op == '>>') ? ")|0)" : ">>>0)";
+    text = text.substring(0, l) + head + rhs + tail + text.substring(r);
+    re.lastIndex = l + head.length; // the right operand may have its own
+  }
+  return text.replace(/__vlsaved(\d+)__/g, (s, n) => saved[n]);
+}
+
 function translateFunction(text : string) : string {
   text = text.trim();
   if (text.match(/VL_RAND_RESET_Q/))
     throw Error("Values longer than 32 bits are not supported");
   var funcname = text.match(/(\w+)/)[1];
+  var ints : {[name:string]:boolean} = Object.create(null); // C++ int locals
+  var re = /\bint (\w+)/g;
+  var m;
+  while ((m = re.exec(text)))
+    ints[m[1]] = true;
   text = text.replace(symsName + "* __restrict ", "");
   text = text.replace(moduleName + "* __restrict vlTOPp VL_ATTR_UNUSED", "var vlTOPp");
   text = text.replace(/\bVL_DEBUG_IF\(([^]+?)\);\n/g,"/*VL_DEBUG_IF($1);*/\n");
@@ -117,6 +261,8 @@ function translateFunction(text : string) : string {
   text = text.replace(/\b->\b/g, ".");
   text = text.replace('VL_INLINE_OPT', '');
   text = text.replace(/[(]IData[)]/g, '');
+  // 32-bit constants with bit 31 set are signed, like the values in __sig
+  text = text.replace(/\b0x([89a-f][0-9a-f]{7})U\b/gi, (s, hex) => "(" + (parseInt(hex, 16)|0) + ")");
   text = text.replace(/\b(0x[0-9a-f]+)U/gi, '$1');
   text = text.replace(/\b([0-9]+)U/gi, '$1');
   text = text.replace(/\bQData /g, 'var ');
@@ -131,6 +277,12 @@ function translateFunction(text : string) : string {
   //[%0t] %Error: scoreboard.v:53: Assertion failed in %Nscoreboard_top.scoreboard_gen: reset 64 -935359306 Vscoreboard_top
   text = text.replace(/Verilated::(\w+)Error/g, 'console.log');
   text = text.replace(/vlSymsp.name[(][)]/g, '"'+moduleName+'"');
+  // scalar signals are accessed directly through the __sig array
+  text = text.replace(/\b(?:vlTOPp|this)\.(\w+)/g, (s, name) => {
+    var sig = sigmap[name];
+    return sig ? "__sig[" + sig.sigidx + "]" : s;
+  });
+  text = translateUnsignedOps(text, ints);
   return "function " + text + "\nthis." + funcname + " = " + funcname + ";\n";
 }
 
@@ -139,7 +291,7 @@ function translateStaticVars(text : string) : string {
   var m;
   var re = /VL_ST_SIG(\d+)[(](\w+?)::(\w+).(\d+).,(\d+),(\d+)[)]/g;
   while (m = re.exec(text)) {
-    s += "var " + m[3] + " = this." + m[3] + " = new Uint" + m[1] + "Array(" + m[4] + ");\n";
+    s += "var " + m[3] + " = this." + m[3] + " = new " + getTypedArrayName(parseInt(m[1])) + "(" + m[4] + ");\n";
   }
   return s;
 }
@@ -152,6 +304,10 @@ function translateStaticVars(text : string) : string {
   parseDecls(htext, ports, 'VL_OUT', false, true);
   var signals = [];
   parseDecls(htext, signals, 'VL_SIG');
+  var layout = layoutSignals(ports, signals);
+  sigmap = Object.create(null);
+  for (var sig of layout)
+    sigmap[sig.name] = sig;
 
   // parse cpp file
   // split functions
@@ -169,11 +325,12 @@ function translateStaticVars(text : string) : string {
     ports:ports,
     signals:signals,
     funcs:funcs,
+    changeDetect:hasChangeDetection(signals),
   };
 
   return {
     output:{
-      code:buildModule(modinput),
+      code:buildModule(modinput, layout),
       name:moduleName,
       ports:ports,
       signals:signals,
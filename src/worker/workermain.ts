@@ -1571,6 +1571,119 @@ function compileReadmemStmts(code, errors) {
   });
 }
 
+// strip comments and redundant whitespace, so that cosmetic edits map to the same key
+// (newlines are kept because `define and friends are line-oriented,
+// and string literals are kept verbatim)
+function normalizeVerilogSource(code:string) : string {
+  var lines = [];
+  var line = "";
+  var space = false; // whitespace seen since the last token
+  var i = 0;
+  var n = code.length;
+  while (i < n) {
+    var ch = code[i];
+    if (ch == '\n') {
+      if (line.length) lines.push(line);
+      line = "";
+      space = false;
+      i++;
+      continue;
+    }
+    if (ch == '/' && code[i+1] == '/') {
+      while (i < n && code[i] != '\n') i++;
+      continue;
+    }
+    if (ch == '/' && code[i+1] == '*') {
+      var end = code.indexOf('*/', i+2);
+      i = end < 0 ? n : end+2;
+      space = true;
+      continue;
+    }
+    if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\f' || ch == '\v') {
+      space = true;
+      i++;
+      continue;
+    }
+    if (space && line.length) line += ' ';
+    space = false;
+    if (ch == '"') {
+      var j = i+1;
+      while (j < n && code[j] != '"' && code[j] != '\n') {
+        if (code[j] == '\\') j++;
+        j++;
+      }
+      if (j < n && code[j] == '"') j++;
+      line += code.substring(i, j);
+      i = j;
+    } else {
+      line += ch;
+      i++;
+    }
+  }
+  if (line.length) lines.push(line);
+  return lines.join('\n');
+}
+
+// translated verilator output, keyed by normalized source of all inputs
+type VerilatorCacheEntry = {key:string, output};
+var verilator_cache : VerilatorCacheEntry[] = [];
+var verilator_cache_hits = 0;
+var VERILATOR_CACHE_SIZE = 16;
+
+function getVerilatorCacheEntry(key:string) : VerilatorCacheEntry {
+  for (var i=0; i<verilator_cache.length; i++) {
+    var entry = verilator_cache[i];
+    if (entry.key == key) {
+      // move to front (most recently used)
+      verilator_cache.splice(i, 1);
+      verilator_cache.unshift(entry);
+      return entry;
+    }
+  }
+  return null;
+}
+
+function putVerilatorCacheEntry(key:string, output) {
+  verilator_cache.unshift({key:key, output:output});
+  if (verilator_cache.length > VERILATOR_CACHE_SIZE)
+    verilator_cache.pop();
+}
+
+// copy so that callers (e.g. compileJSASM) can't modify the cached output
+function copyVerilatorOutput(output) {
+  return {
+    code:output.code,
+    name:output.name,
+    ports:output.ports,
+    signals:output.signals,
+  };
+}
+
+// reuse the same 256 MB heap for every verilator run instead of allocating a new one
+var VERILATOR_TOTAL_MEMORY = 256*1024*1024;
+var verilator_heap;
+var verilator_heap_top = 0; // sbrk() after the last run; nothing above it was touched
+function getVerilatorHeap() {
+  if (!(CACHE_WASM_MODULES && typeof WebAssembly === 'object'))
+    return null;
+  var pages = VERILATOR_TOTAL_MEMORY / 65536;
+  if (!verilator_heap) {
+    verilator_heap = new WebAssembly.Memory({initial:pages, maximum:pages});
+  } else {
+    // emscripten expects a zeroed heap
+    new Uint8Array(verilator_heap.buffer, 0, verilator_heap_top).fill(0);
+  }
+  verilator_heap_top = VERILATOR_TOTAL_MEMORY; // until the run reports its break
+  return verilator_heap;
+}
+function setVerilatorHeapTop(mod) {
+  try {
+    verilator_heap_top = Math.min(mod._sbrk(0), VERILATOR_TOTAL_MEMORY);
+  } catch (e) {
+    console.log(e);
+  }
+}
+
 function compileVerilator(step:BuildStep) {
   loadNative("verilator_bin");
   loadGen("worker/verilator2js");
@@ -1581,25 +1694,55 @@ function compileVerilator(step:BuildStep) {
   // compile verilog if files are stale
   var outjs = "main.js";
   if (staleFiles(step, [outjs])) {
+    var code = getWorkFileAsString(step.path);
+    var topmod = detectTopModuleName(code);
+    // preprocess all files once, and build cache key from the results
+    var processed : {[path:string]:FileData} = {};
+    var cachekey = platform + "/" + topmod;
+    for (var path of step.files) {
+      var data = workfs[path].data;
+      if (typeof data === 'string') {
+        data = compileReadmemStmts(data, errors);
+        data = compileInlineASM(data, platform, step, errors, asmlines);
+        cachekey += "\n//" + path + "\n" + normalizeVerilogSource(data);
+      } else {
+        cachekey += "\n//" + path + " " + data.length;
+      }
+      processed[path] = data;
+    }
+    // only cosmetic changes? reuse previous translation
+    var cached = errors.length == 0 && getVerilatorCacheEntry(cachekey);
+    if (cached) {
+      verilator_cache_hits++;
+      console.log("verilator cache hit", topmod);
+      putWorkFile(outjs, cached.output.code);
+      if (!anyTargetChanged(step, [outjs]))
+        return;
+      var listings = {};
+      if (asmlines.length)
+        listings[step.path] = {lines:asmlines};
+      return {
+        output: copyVerilatorOutput(cached.output),
+        errors: errors,
+        listings: listings,
+      };
+    }
     var match_fn = makeErrorMatcher(errors, /%(.+?): (.+?):(\d+)?[:]?\s*(.+)/i, 3, 4, step.path, 2);
+    var heap = getVerilatorHeap();
     var verilator_mod = emglobal.verilator_bin({
       instantiateWasm: moduleInstFn('verilator_bin'),
       noInitialRun:true,
       print:print_fn,
       printErr:match_fn,
-      TOTAL_MEMORY:256*1024*1024,
+      TOTAL_MEMORY:VERILATOR_TOTAL_MEMORY,
+      wasmMemory:heap || undefined,
+      buffer:heap ? heap.buffer : undefined,
     });
-    var code = getWorkFileAsString(step.path);
-    var topmod = detectTopModuleName(code);
     var FS = verilator_mod['FS'];
-    populateFiles(step, FS, {
-      mainFilePath:step.path,
-      processFn:(code) => {
-        code = compileReadmemStmts(code, errors);
-        code = compileInlineASM(code, platform, step, errors, asmlines);
-        return code;
-      }
-    });
+    for (var path of step.files) {
+      var entry = workfs[path];
+      populateEntry(FS, path, {path:path, data:processed[path], encoding:entry.encoding, ts:entry.ts}, null);
+    }
     starttime();
     try {
       var args = ["--cc", "-O3", "-DEXT_INLINE_ASM", "-DTOPMOD__"+topmod,
@@ -1611,6 +1754,7 @@ function compileVerilator(step:BuildStep) {
       console.log(e);
       errors.push({line:0,msg:"Compiler internal error: " + e});
     }
+    if (heap) setVerilatorHeapTop(verilator_mod);
     endtime("compile");
     // remove boring errors
     errors = errors.filter(function(e) { return !/Exiting due to \d+/.exec(e.msg); }, errors);
@@ -1622,6 +1766,7 @@ function compileVerilator(step:BuildStep) {
       var h_file = FS.readFile("obj_dir/V"+topmod+".h", {encoding:'utf8'});
       var cpp_file = FS.readFile("obj_dir/V"+topmod+".cpp", {encoding:'utf8'});
       var rtn = translateVerilatorOutputToJS(h_file, cpp_file);
+      putVerilatorCacheEntry(cachekey, rtn.output);
       putWorkFile(outjs, rtn.output.code);
       if (!anyTargetChanged(step, [outjs]))
         return;
@@ -1636,7 +1781,7 @@ function compileVerilator(step:BuildStep) {
     if (asmlines.length)
       listings[step.path] = {lines:asmlines};
     return {
-      output: rtn.output,
+      output: copyVerilatorOutput(rtn.output),
       errors: errors,
       listings: listings,
     };
@@ -1,6 +1,7 @@
 
 var assert = require('assert');
 var fs = require('fs');
+var crypto = require('crypto');
 var wtu = require('./workertestutils.js');
 var PNG = require('pngjs').PNG;
 
@@ -18,6 +19,7 @@ global.includeInThisContext('src/cpu/z80fast.js');
 includeInThisContext("javatari.js/release/javatari/javatari.js");
 Javatari.AUTO_START = false;
 includeInThisContext('src/cpu/z80fast.js');
+includeInThisContext('src/cpu/6809.js');
 includeInThisContext('tss/js/Log.js');
 //global.Log = require('tss/js/Log.js').Log;
 includeInThisContext('tss/js/tss/PsgDeviceChannel.js');
@@ -156,6 +158,525 @@ function testPlatform(platid, romname, maxframes, callback) {
     return platform;
 }
 
+// a started platform with a ROM loaded, from test/roms/<platid>/ or given as bytes
+function startPlatform(platid, rom) {
+    var emudiv = document.getElementById('emulator');
+    var platform = new emu.PLATFORMS[platid](emudiv);
+    platform.start();
+    if (typeof rom === 'string')
+      rom = fs.readFileSync('./test/roms/' + platid + '/' + rom);
+    platform.loadROM("ROM", new Uint8Array(rom));
+    return platform;
+}
+
+function testTimingAnalysis(platform, minpcs) {
+    var analyzer = platform.newCodeAnalyzer();
+    analyzer.showLoopTimingForPC(0);
+    var npcs = Object.keys(analyzer.pc2minclocks).length;
+    assert.ok(npcs >= minpcs, npcs + " PCs analyzed");
+    for (var pc in analyzer.pc2minclocks) {
+      assert.ok(analyzer.pc2minclocks[pc] <= analyzer.pc2maxclocks[pc]);
+      assert.ok(analyzer.pc2maxclocks[pc] <= analyzer.MAX_CLOCKS);
+    }
+    // unchanged ROM reuses the last result
+    var analyzer2 = platform.newCodeAnalyzer();
+    analyzer2.showLoopTimingForPC(0);
+    assert.strictEqual(analyzer.pc2minclocks, analyzer2.pc2minclocks);
+}
+
+function benchmarkBreakpoints(platid, romname, nbps, filtered, nframes) {
+    var platform = startPlatform(platid, romname);
+    platform.resume();
+    // breakpoints that never fire
+    for (var i=0; i<nbps; i++)
+      platform.setBreakpoint('bench'+i, () => { return false; }, filtered ? {pcs:[0xffff-i]} : null);
+    var label = platid + ": " + nbps + (filtered ? " PC" : " expression") + " breakpoints, " + nframes + " frames";
+    console.time(label);
+    for (var i=0; i<nframes; i++)
+      platform.nextFrame();
+    console.timeEnd(label);
+    assert.ok(!platform.wasBreakpointHit());
+    return platform;
+}
+
+// a PC-filtered breakpoint must stop where single-stepping the same condition does
+function testBreakAtPC(platid, romname) {
+    var platform = startPlatform(platid, romname);
+    platform.resume();
+    for (var i=0; i<30; i++)
+      platform.nextFrame();
+    var state0 = platform.saveState();
+    var pc = platform.getCPUState().PC;
+    function runToBreak(filtered) {
+      platform.loadState(state0);
+      platform.setupDebug(() => { });
+      var nhits = 0;
+      platform.setDebugCondition(() => {
+        var c = platform.getCPUState();
+        if (c.PC == pc && ++nhits == 3) {
+          platform.breakpointHit(c.T);
+          return true;
+        }
+        return false;
+      }, filtered ? {pcs:[pc]} : null);
+      assert.equal(filtered, platform.breakpoints.pcOnly);
+      for (var i=0; i<3 && !platform.wasBreakpointHit(); i++)
+        platform.nextFrame();
+      assert.ok(platform.wasBreakpointHit());
+      var c = platform.getCPUState();
+      platform.clearDebug();
+      return c;
+    }
+    assert.deepEqual(runToBreak(false), runToBreak(true));
+}
+
+// a memory-watch breakpoint must stop where testing the same condition
+// before every instruction does, without being called as often
+function testBreakOnWatch(platid, romname, addr, key) {
+    var platform = startPlatform(platid, romname);
+    platform.resume();
+    for (var i=0; i<30; i++)
+      platform.nextFrame();
+    keycallback(key.c, key.c, 1);
+    var state0 = platform.saveState();
+    function runToBreak(filtered) {
+      platform.loadState(state0);
+      platform.setupDebug(() => { });
+      var last = platform.readAddress(addr);
+      var ncalls = 0;
+      platform.setDebugCondition(() => {
+        ncalls++;
+        if (platform.readAddress(addr) != last) {
+          platform.breakpointHit(platform.getCPUState().T);
+          return true;
+        }
+        return false;
+      }, filtered ? {watch:[addr,addr]} : null);
+      assert.equal(filtered, platform.breakpoints.watchmap != null);
+      for (var i=0; i<10 && !platform.wasBreakpointHit(); i++)
+        platform.nextFrame();
+      assert.ok(platform.wasBreakpointHit());
+      var c = platform.getCPUState();
+      platform.clearDebug();
+      return {c:c, ncalls:ncalls};
+    }
+    var slow = runToBreak(false);
+    var watched = runToBreak(true);
+    assert.deepEqual(watched.c, slow.c);
+    assert.ok(watched.ncalls*10 < slow.ncalls, watched.ncalls + " watch calls vs " + slow.ncalls);
+}
+
+// self-modifying code on a Williams-style memory map: ROM banked over RAM at
+// 0x0000-0x8fff, and RAM at 0x9000 marked as code, run with and without the fetch cache
+function run6809CodeCache(cached) {
+    var rom = new Uint8Array(0x10000);
+    var ram = new Uint8Array(0x10000);
+    var banksel = 0;
+    var cpu = new CPU6809();
+    function bank(v) { banksel = v & 1; cpu.setCodeCache(0x0000, 0x8fff, banksel != 0); }
+    var prog = [
+      0x10,0xce,0xbf,0x00,  // d000 LDS #$bf00
+      0x8e,0x20,0x00,       // d004 LDX #$2000
+      0x86,0x01,            // LDA #1
+      0xb7,0xc9,0x00,       // STA $c900 (ROM bank)
+      0xad,0x84,            // JSR ,X
+      0xf7,0xa0,0x00,       // STB $a000
+      0x7f,0xc9,0x00,       // CLR $c900 (RAM bank)
+      0xad,0x84,            // JSR ,X
+      0xf7,0xa0,0x01,       // STB $a001
+      0xbd,0x90,0x00,       // JSR $9000
+      0xf7,0xa0,0x02,       // STB $a002
+      0x7c,0x90,0x01,       // INC $9001 (patch the operand)
+      0xbd,0x90,0x00,       // JSR $9000
+      0xf7,0xa0,0x03,       // STB $a003
+      0x86,0x01,            // LDA #1
+      0xb7,0xc9,0x00,       // STA $c900 (ROM bank)
+      0x7c,0x20,0x01,       // INC $2001 (RAM under the ROM)
+      0xad,0x84,            // JSR ,X
+      0xf7,0xa0,0x04,       // STB $a004
+      0x7f,0xc9,0x00,       // CLR $c900 (RAM bank)
+      0xad,0x84,            // JSR ,X
+      0xf7,0xa0,0x05,       // STB $a005
+      0x7c,0xa0,0x10,       // INC $a010
+    ];
+    var loop = 0xd004 - (0xd000 + prog.length + 2);
+    prog.push(0x20, loop & 0xff); // BRA $d004
+    rom.set(prog, 0xd000);
+    rom.set([0xc6,0x11,0x39], 0x2000);  // ROM: LDB #$11; RTS
+    ram.set([0xc6,0x22,0x39], 0x2000);  // RAM: LDB #$22; RTS
+    ram.set([0xc6,0x33,0x39], 0x9000);  // RAM: LDB #$33; RTS
+    rom[0xfffe] = 0xd0; rom[0xffff] = 0x00;
+    cpu.init(function(a,v) {
+      if (a == 0xc900) bank(v);
+      else if (a < 0xc000) ram[a] = v;
+    }, function(a) {
+      if (a < 0x9000) return banksel ? rom[a] : ram[a];
+      if (a < 0xc000) return ram[a];
+      return a >= 0xd000 ? rom[a] : 0;
+    }, 0);
+    cpu.enableCodeCache(cached);
+    cpu.setCodeCache(0xd000, 0xffff, true);
+    cpu.setCodeCache(0x9000, 0x9fff, true); // RAM holding code
+    cpu.runFrame(200000);
+    return {regs:cpu.saveState(), ram:Array.from(ram.slice(0x2000,0x2004)).concat(Array.from(ram.slice(0x9000,0x9004)), Array.from(ram.slice(0xa000,0xa011)))};
+}
+
+function benchmarkCodeCache(platid, romname, nframes) {
+    var platform = startPlatform(platid, romname);
+    platform.resume();
+    for (var i=0; i<60; i++)
+      platform.nextFrame();
+    var state0 = platform.saveState();
+    // the profiler steps one instruction at a time, so count them with it
+    var ninsns = 0;
+    platform.startSampling().record = () => { ninsns++; };
+    for (var i=0; i<nframes; i++)
+      platform.nextFrame();
+    platform.stopSampling();
+    var state1 = platform.saveState();
+    function timeFrames(label) {
+      platform.loadState(state0);
+      var t0 = new Date().getTime();
+      for (var i=0; i<nframes; i++)
+        platform.nextFrame();
+      var ms = new Date().getTime() - t0;
+      console.log(platid + ": " + label + ", " + Math.round(ninsns*1000/Math.max(1,ms)) + " insns/sec");
+      assert.deepEqual(state1, platform.saveState());
+    }
+    timeFrames("code cache");
+    assert.ok(platform._cpu.getCodeBlocksCompiled() > 0, "no code blocks compiled");
+    platform._cpu.setCodeCache(0x0000, 0xffff, false);
+    timeFrames("interpreter");
+}
+
+// one galaxian frame of every tile, sprites in each flip, and bullets,
+// drawn from scripted VRAM/OAM with the CPU halted
+function renderGalaxianScripted() {
+    var rom = new Uint8Array(0x5020);
+    rom.set(fs.readFileSync('./test/roms/galaxian-scramble/shoot2.c.rom'));
+    rom.set([0xf3, 0x76], 0); // DI; HALT
+    var platform = startPlatform('galaxian-scramble', rom);
+    var state = platform.saveState();
+    state.ie = 0;
+    state.se = 0; // stars are random
+    for (var i=0; i<0x400; i++)
+      state.bv[i] = i & 0xff;
+    for (var xx=0; xx<32; xx++) {
+      state.bo[xx*2] = xx*3;     // scroll
+      state.bo[xx*2+1] = xx & 7; // color
+    }
+    for (var n=0; n<8; n++) {
+      var base = 0x40 + n*4;
+      state.bo[base] = 0x30 + n*20;                  // y
+      state.bo[base+1] = ((n*9) & 0x3f) | (n << 6);  // code, flipx (bit 6), flipy (bit 7)
+      state.bo[base+2] = n;                          // color
+      state.bo[base+3] = 0x20 + n*24;                // x
+      state.bo[0x60+n*4+1] = 0x40 + n*16;            // bullet y
+      state.bo[0x60+n*4+3] = 0x30 + n*20;            // bullet x
+    }
+    platform.loadState(state);
+    platform.nextFrame();
+    return crypto.createHash('md5').update(Buffer.from(lastrastervideo.getFrameData().buffer)).digest('hex');
+}
+
+// frame time with and without video, to see what rendering costs
+function benchmarkFrames(platid, romname, nframes) {
+    var platform = startPlatform(platid, romname);
+    for (var i=0; i<60; i++)
+      platform.advance(false);
+    var state0 = platform.saveState();
+    function timeFrames(novideo) {
+      platform.loadState(state0);
+      var t0 = new Date().getTime();
+      for (var i=0; i<nframes; i++)
+        platform.advance(novideo);
+      return (new Date().getTime() - t0) / nframes;
+    }
+    var msvideo = timeFrames(false);
+    var msnovideo = timeFrames(true);
+    console.log(platid + ": " + msvideo.toFixed(3) + " ms/frame, " + (msvideo - msnovideo).toFixed(3) + " ms/frame video");
+    return platform;
+}
+
+// run-ahead must not change where the real frames end up
+function testRunAhead(platid, romname, nframes, aheadframes) {
+    function run(ahead) {
+      var platform = startPlatform(platid, romname);
+      platform.setRunAhead(ahead);
+      for (var i=0; i<nframes; i++) {
+        if (i == nframes>>1) keycallback(Keys.VK_SPACE.c, Keys.VK_SPACE.c, 1);
+        platform.nextFrame();
+      }
+      return platform;
+    }
+    var p0 = run(0);
+    var p1 = run(aheadframes);
+    assert.deepEqual(p1.saveState(), p0.saveState());
+    console.log(platid + " run-ahead " + aheadframes + ": " + p1.getRunAheadStats().toString());
+}
+
+// for platforms that draw at RAM-write time: each tick shows the frame
+// the plain run reaches N frames later, and the rollback takes the pixels back
+function testRunAheadVideo(platid, romname, nticks, aheadframes, key) {
+    var press = nticks>>1;
+    function run(ahead, nframes, fn) {
+      var platform = startPlatform(platid, romname);
+      var video = lastrastervideo;
+      var shown;
+      video.updateFrame = function() { shown = video.getFrameData().slice(0); };
+      platform.setRunAhead(ahead);
+      for (var i=0; i<nframes; i++) {
+        if (i == press) keycallback(key.c, key.c, 1);
+        platform.nextFrame();
+        fn(i, shown, video.getFrameData());
+      }
+    }
+    var frames = [];
+    run(0, nticks+aheadframes, (i, shown, pixels) => { frames.push(pixels.slice(0)); });
+    run(aheadframes, nticks, (i, shown, pixels) => {
+      if (i < 30) return; // until the game has drawn the whole screen
+      assert.deepEqual(pixels, frames[i], "pixels after rollback, tick " + i);
+      // frames run ahead just before the key press are mispredicted
+      if (i < press-aheadframes || i >= press)
+        assert.deepEqual(shown, frames[i+aheadframes], "frame shown, tick " + i);
+    });
+}
+
+// turbo ticks must land on the same frames as running them one by one
+function testTurbo(platid, romname, nticks, turbo) {
+    function run(frames, turbo) {
+      var platform = startPlatform(platid, romname);
+      platform.setTurbo(turbo);
+      for (var i=0; i<nticks; i++) {
+        if (i == nticks>>1) keycallback(Keys.VK_SPACE.c, Keys.VK_SPACE.c, 1);
+        for (var j=0; j<frames; j++)
+          platform.nextFrame();
+      }
+      return platform;
+    }
+    var p0 = run(turbo, 0);
+    var p1 = run(1, turbo);
+    assert.deepEqual(p1.saveState(), p0.saveState());
+}
+
+// the heatmap counts executes at instruction starts, and every
+// write is charged to an instruction that ran
+function testHeatmap(platform, nframes) {
+    var inst = platform.startInstrumentation();
+    assert.ok(inst);
+    for (var i=0; i<nframes; i++)
+      platform.nextFrame();
+    platform.stopInstrumentation();
+    var nexecs = 0;
+    var nwrites = 0;
+    for (var a=0; a<0x10000; a++) {
+      if (inst.execs[a]) nexecs++;
+      if (inst.writes[a]) {
+        nwrites++;
+        var pc = inst.lastWriterPC[a];
+        assert.ok(pc >= 0 && inst.execs[pc] > 0, "write to $" + a.toString(16) + " from $" + pc.toString(16));
+      }
+    }
+    assert.ok(nexecs > 0, "no executes");
+    assert.ok(nwrites > 0, "no writes");
+    return inst;
+}
+
+// a tiny 6809 program for the williams memory map (ROM at 0xd000 is file offset 0x9000)
+function williams6809TestROM() {
+    var rom = new Uint8Array(0xc000);
+    rom.set([
+      0x10,0xce,0xbf,0x00,  // d000 LDS #$bf00
+      0x86,0x39,            // d004 LDA #$39
+      0xb7,0xcb,0xff,       // d006 STA $cbff (watchdog)
+      0x7c,0x98,0x00,       // d009 INC $9800
+      0x20,0xf6,            // d00c BRA $d004
+    ], 0x9000);
+    rom[0xbffe] = 0xd0; rom[0xbfff] = 0x00; // reset vector
+    return rom;
+}
+
+// screen writes through the astrocade magic register, for several magic modes
+function benchmarkAstrocadeMagic(nwrites) {
+    var platform = startPlatform('astrocade', 'cosmic.c.rom');
+    for (var i=0; i<60; i++)
+      platform.nextFrame();
+    var state = platform.saveState();
+    var bus = platform.probe.bus;
+    // plain, expand, expand+or, expand+xor, flop+shift
+    for (var magicop of [0x00, 0x08, 0x18, 0x28, 0x41]) {
+      state.magicop = magicop;
+      state.xpand = 0x1c;
+      platform.loadState(state);
+      var t0 = new Date().getTime();
+      for (var i=0; i<nwrites; i++)
+        bus.write(i & 0xfff, i & 0xff); // magic writes to screen RAM
+      var ms = new Date().getTime() - t0;
+      console.log("astrocade: magic op $" + magicop.toString(16) + ", " + Math.round(nwrites*1000/Math.max(1,ms)) + " writes/sec");
+    }
+}
+
+// the astrocade magic register as written before it used tables, one bit at a time
+function astrocadeMagicWrite(m, a, v) {
+    // expand
+    if (m.magicop & 0x8) {
+      var v2 = 0;
+      if (!m.xplower)
+        v >>= 4;
+      for (var i=0; i<4; i++) {
+        var pix = (v&1) ? ((m.xpand>>2)&3) : (m.xpand&3);
+        v2 |= pix << (i*2);
+        v >>= 1;
+      }
+      v = v2;
+      m.xplower = !m.xplower;
+    }
+    // shift
+    var sh = (m.magicop & 3) << 1;
+    var v2 = (v >> sh) | m.shift2;
+    m.shift2 = (v << (8-sh)) & 0xff;
+    v = v2;
+    // flop
+    if (m.magicop & 0x40) {
+      var v2 = 0;
+      for (var i=0; i<4; i++) {
+        v2 |= (v & 3) << (6-i*2);
+        v >>= 2;
+      }
+      v = v2;
+    }
+    // or/xor
+    if (m.magicop & 0x30) {
+      var oldv = m.b[a];
+      if (m.magicop & 0x10)
+        v |= oldv;
+      if (m.magicop & 0x20)
+        v ^= oldv;
+      // collision detect
+      var icpt = 0;
+      for (var i=0; i<8; i+=2) {
+        icpt <<= 1;
+        if ( !((oldv>>i)&3) && ((v>>i)&3) )
+          icpt |= 1;
+      }
+      m.in[8] = (m.in[8] & 0xf0) | icpt | (icpt<<4);
+    }
+    m.b[a] = v;
+}
+
+// magic writes of every byte, in both expand nibbles, for each xpand color pair
+function testAstrocadeMagic() {
+    var platform = startPlatform('astrocade', 'cosmic.c.rom');
+    for (var i=0; i<60; i++)
+      platform.nextFrame();
+    var state = platform.saveState();
+    var bus = platform.probe.bus;
+    // expand, expand+or, expand+xor, flop, flop+or+shift, flop+xor, expand+flop+or+shift
+    for (var magicop of [0x08, 0x18, 0x28, 0x40, 0x51, 0x62, 0x5b]) {
+      for (var xpand=0; xpand<16; xpand++) {
+        state.magicop = magicop;
+        state.xpand = xpand;
+        state.xplower = false;
+        state.shift2 = 0;
+        state.in[8] = 0;
+        platform.loadState(state);
+        var m = {magicop:magicop, xpand:xpand, xplower:false, shift2:0, b:state.b.slice(0), in:state.in.slice(0)};
+        for (var i=0; i<512; i++) {
+          var v = i >> 1; // each byte twice, for the upper and lower nibble
+          var a = (i * 37) & 0xfff;
+          bus.write(a, v);
+          astrocadeMagicWrite(m, a, v);
+          assert.equal(m.b[a], platform.readAddress(0x4000 + a), "op $" + magicop.toString(16) + " xpand " + xpand + " byte " + v);
+          assert.equal(m.in[8], platform.saveControlsState().in[8], "intercept, op $" + magicop.toString(16) + " byte " + v);
+        }
+        var s = platform.saveState();
+        assert.equal(m.xplower, s.xplower);
+        assert.equal(m.shift2, s.shift2);
+      }
+    }
+}
+
+// minimal 5200 BIOS: a made-up character set at $F800,
+// then jump to the cartridge and copy color and display list shadows on NMI
+function atari5200TestBIOS() {
+  var bios = new Uint8Array(0x800);
+  for (var i=0; i<0x400; i++)
+    bios[i] = (i>>3) ^ (i<<5);
+  bios.set([0x6c,0xfe,0xbf], 0x600); // JMP ($BFFE)
+  bios.set([0x48,
+            0xa5,0x0c, 0x8d,0x16,0xc0, 0xa5,0x0d, 0x8d,0x17,0xc0, 0xa5,0x0e, 0x8d,0x18,0xc0,
+            0xa5,0x0f, 0x8d,0x19,0xc0, 0xa5,0x10, 0x8d,0x1a,0xc0,
+            0xa5,0x05, 0x8d,0x02,0xd4, 0xa5,0x06, 0x8d,0x03,0xd4, 0xa5,0x07, 0x8d,0x00,0xd4,
+            0x8d,0x0f,0xd4,
+            0x68, 0x40], 0x610); // PHA, LDA/STA..., PLA, RTI
+  bios[0x640] = 0x40; // RTI
+  bios.set([0x10,0xfe, 0x00,0xfe, 0x40,0xfe], 0x7fa); // NMI, RESET, IRQ
+  return bios;
+}
+
+function renderAtari8Frames(romname, nframes) {
+    var emudiv = document.getElementById('emulator');
+    var platform = new emu.PLATFORMS['atari8-5200'](emudiv);
+    platform.start();
+    platform.loadBIOS("BIOS", atari5200TestBIOS());
+    platform.loadROM("ROM", new Uint8Array(fs.readFileSync('./test/roms/atari8-5200/' + romname)));
+    var frames = [];
+    for (var i=0; i<nframes; i++) {
+      platform.nextFrame();
+      frames.push(lastrastervideo.getFrameData().slice(0));
+    }
+    return frames;
+}
+
+// renders frames with a scripted bus master in place of the 6502,
+// so they only depend on ANTIC and GTIA (and match without javatari)
+function renderAtari8Scripted(nframes) {
+    var seed = 12345;
+    var rnd = () => (seed = (Math.imul(seed, 1103515245) + 12345) & 0x7fffffff) >> 8;
+    var cpu = {
+      bus: null,
+      clockPulse() {
+        var bus = this.bus;
+        var r = rnd() % 10000;
+        if (r < 250) bus.write(0xc012 + rnd() % 9, rnd() & 0xff);        // COLPMx/COLPFx/COLBK
+        else if (r < 700) bus.write(0x2000 + rnd() % 0x800, rnd() & 0xff); // screen RAM
+        else if (r < 705) bus.write(0xd409, (rnd() & 1) ? 0x30 : 0x34);   // CHBASE
+        else if (r < 710) bus.write(0xd401, rnd() & 7);                   // CHACTL
+        else if (r < 740) bus.write(0xd40f, 0);                           // NMIRES
+        else if (r < 742) bus.write(0xd400, [0x22,0x21,0x23,0x00][rnd() % 4]); // DMACTL
+      },
+      setNMIAndWait() { return 7; },
+      reset() { },
+      saveState() { return {PC:0x4000}; },
+      loadState(s) { },
+    };
+    var emudiv = document.getElementById('emulator');
+    var platform = new emu.PLATFORMS['atari8-5200'](emudiv);
+    platform.newCPU = (bus) => { cpu.bus = bus; return cpu; };
+    platform.start();
+    var bus = cpu.bus;
+    // text, 4bpp and 4-color lines, with DLIs
+    var dlist = [0x70,0x70,0x70, 0x42,0x00,0x20, 2,2,2,2,2,2,2, 0x84,4,4,4,4,4,
+                 0x46,0x00,0x24, 6,6,6,6,6, 0x0a,0x0a,0x0a,0x0a,0x8a,0x0a,0x0a, 0x41,0x00,0x10];
+    dlist.forEach((v,i) => bus.write(0x1000+i, v));
+    for (var a=0x2000; a<0x3800; a++)
+      bus.write(a, rnd() & 0xff);
+    for (var i=0; i<9; i++)
+      bus.write(0xc012+i, i*0x1c);
+    bus.write(0xd402, 0x00); // DLISTL
+    bus.write(0xd403, 0x10); // DLISTH
+    bus.write(0xd409, 0x30); // CHBASE
+    bus.write(0xd40e, 0xc0); // NMIEN
+    bus.write(0xd400, 0x22); // DMACTL
+    var hashes = [];
+    for (var i=0; i<nframes; i++) {
+      platform.nextFrame();
+      var frame = lastrastervideo.getFrameData();
+      hashes.push(crypto.createHash('md5').update(Buffer.from(frame.buffer)).digest('hex').substr(0,8));
+    }
+    return hashes;
+}
+
 describe('Platform Replay', () => {
 
   it('Should run apple2', () => {
@@ -182,15 +703,34 @@ describe('Platform Replay', () => {
     });
     assert.equal(platform.saveState().p.SA, 0xff ^ 0x40);
     assert.equal(60, platform.readAddress(0x80)); // player x pos
+    testTimingAnalysis(platform, 300);
   });
 
   it('Should run nes', () => {
     var platform = testPlatform('nes', 'shoot2.c.rom', 72, (platform, frameno) => {
+      if (frameno == 0) {
+        platform.toggleDebugView('nt');
+        platform.toggleDebugView('pt');
+        platform.toggleDebugView('oam');
+      }
       if (frameno == 62) {
         keycallback(Keys.VK_LEFT.c, Keys.VK_LEFT.c, 1);
       }
     });
     assert.equal(120-10, platform.readAddress(0x41d)); // player x pos
+    // PPU renders in place, every pixel should be opaque
+    assert.ok(platform.video.getFrameData().every((p) => (p >>> 24) == 0xff));
+    // incremental debug views should match a full redraw
+    for (var i=0; i<30; i++)
+      platform.advance(false);
+    platform.updateDebugViews();
+    var views = [platform.ntvideo, platform.ptvideo, platform.oamvideo];
+    var frames = views.map((v) => v.getFrameData().slice(0));
+    platform.debugFull = true;
+    platform.updateDebugViews();
+    for (var i=0; i<views.length; i++)
+      assert.deepEqual(views[i].getFrameData(), frames[i]);
+    benchmarkFrames('nes', 'shoot2.c.rom', 300);
   });
 
   it('Should run vicdual', () => {
@@ -209,6 +749,9 @@ describe('Platform Replay', () => {
     });
     assert.equal(96-9*2, platform.readAddress(0x2006)); // player x pos
   });
+  it('Should run mw8080bw with run-ahead', () => {
+    testRunAheadVideo('mw8080bw', 'game2.c.rom', 120, 2, Keys.VK_LEFT);
+  });
 
   it('Should run galaxian', () => {
     var platform = testPlatform('galaxian-scramble', 'shoot2.c.rom', 72, (platform, frameno) => {
@@ -217,6 +760,20 @@ describe('Platform Replay', () => {
       }
     });
     assert.equal(112-10, platform.readAddress(0x4074)); // player x pos
+    testTimingAnalysis(platform, 1000);
+  });
+  it('Should render galaxian frames like the per-bit renderer', () => {
+    // hash from the renderer that read both bitplanes from ROM for each pixel
+    assert.equal('a67805deed976d822924013f63b45697', renderGalaxianScripted());
+  });
+  it('Should time galaxian frames', () => {
+    benchmarkFrames('galaxian-scramble', 'shoot2.c.rom', 300);
+  });
+  it('Should run galaxian with run-ahead', () => {
+    testRunAhead('galaxian-scramble', 'shoot2.c.rom', 120, 2);
+  });
+  it('Should run galaxian in turbo mode', () => {
+    testTurbo('galaxian-scramble', 'shoot2.c.rom', 30, 4);
   });
 
   it('Should run vector', () => {
@@ -234,6 +791,87 @@ describe('Platform Replay', () => {
       }
     });
   });
+  it('Should run galaxian with breakpoints', () => {
+    benchmarkBreakpoints('galaxian-scramble', 'shoot2.c.rom', 0, true, 120);
+    benchmarkBreakpoints('galaxian-scramble', 'shoot2.c.rom', 1, true, 120);
+    benchmarkBreakpoints('galaxian-scramble', 'shoot2.c.rom', 64, true, 120);
+    benchmarkBreakpoints('galaxian-scramble', 'shoot2.c.rom', 1, false, 120);
+    benchmarkBreakpoints('vicdual', 'snake1.c.rom', 64, true, 120);
+    benchmarkBreakpoints('williams-z80', 'game1.c.rom', 64, true, 120);
+    benchmarkBreakpoints('williams-z80', 'game1.c.rom', 1, false, 120);
+    testBreakAtPC('galaxian-scramble', 'shoot2.c.rom');
+    testBreakAtPC('williams-z80', 'game1.c.rom');
+    testBreakOnWatch('galaxian-scramble', 'shoot2.c.rom', 0x4074, Keys.VK_LEFT); // player x pos
+  });
+  it('Should run apple2 with breakpoints', () => {
+    benchmarkBreakpoints('apple2', 'cosmic.c.rom', 0, true, 60);
+    benchmarkBreakpoints('apple2', 'cosmic.c.rom', 64, true, 60);
+    benchmarkBreakpoints('apple2', 'cosmic.c.rom', 1, false, 60);
+    testBreakAtPC('apple2', 'cosmic.c.rom');
+  });
+  it('Should run Z80 platforms with the code cache', () => {
+    benchmarkCodeCache('galaxian-scramble', 'shoot2.c.rom', 300);
+    benchmarkCodeCache('vicdual', 'snake1.c.rom', 300);
+    benchmarkCodeCache('mw8080bw', 'game2.c.rom', 300);
+    benchmarkCodeCache('coleco', 'shoot.c.rom', 300);
+    benchmarkCodeCache('sms-sg1000-libcv', 'shoot.c.rom', 300);
+    benchmarkCodeCache('astrocade', 'cosmic.c.rom', 300);
+  });
+  it('Should invalidate the 6809 fetch cache on writes and bank switches', () => {
+    var cached = run6809CodeCache(true);
+    assert.deepEqual(run6809CodeCache(false), cached);
+    assert.equal(0x11, cached.ram[8]); // ROM bank routine
+    assert.ok(cached.ram[24] > 100);   // loop count
+  });
+  it('Should count executes in the heatmap', () => {
+    var runs = [
+      ['galaxian-scramble', 'shoot2.c.rom'], // Z80
+      ['apple2', 'cosmic.c.rom'], // 6502
+      ['williams', williams6809TestROM()], // 6809
+    ];
+    for (var [platid, rom] of runs) {
+      var platform = startPlatform(platid, rom);
+      var inst = testHeatmap(platform, 30);
+      if (platid == 'williams') {
+        assert.ok(inst.execs[0xd009] > 100);
+        assert.equal(0xd009, inst.lastWriterPC[0x9800]);
+      }
+    }
+  });
+  it('Should step galaxian backwards', () => {
+    var platform = startPlatform('galaxian-scramble', 'shoot2.c.rom');
+    platform.resume();
+    for (var i=0; i<30; i++)
+      platform.nextFrame();
+    platform.setupDebug(() => { });
+    function runToBreak() {
+      for (var i=0; i<3 && !platform.wasBreakpointHit(); i++)
+        platform.nextFrame();
+      assert.ok(platform.wasBreakpointHit());
+    }
+    function snapshot() {
+      var mem = [];
+      for (var a=0x4000; a<0x4800; a++)
+        mem.push(platform.readAddress(a));
+      return {c:platform.getCPUState(), mem:mem};
+    }
+    // step forward, then back over the same instructions from the journal
+    var history = [];
+    for (var i=0; i<50; i++) {
+      platform.step();
+      runToBreak();
+      history.push(snapshot());
+    }
+    for (var i=history.length-2; i>=0; i--) {
+      platform.stepBack();
+      assert.ok(platform.wasBreakpointHit());
+      assert.deepEqual(history[i], snapshot());
+    }
+    // and forward again
+    platform.step();
+    runToBreak();
+    assert.deepEqual(history[1], snapshot());
+  });
 /*
   it('Should run sound_williams', () => {
     var platform = testPlatform('sound_williams-z80', 'swave.c.rom', 72, (platform, frameno) => {
@@ -243,6 +881,20 @@ describe('Platform Replay', () => {
     });
   });
 */
+  it('Should render sound_williams headless', () => {
+    var rom = new Uint8Array(fs.readFileSync('./test/roms/sound_williams-z80/swave.c.rom'));
+    var cmds = [];
+    for (var i=0; i<8; i++)
+      cmds.push({time:i*0.5, command:i+1});
+    var r = _sound_williams.renderWilliamsSound(rom, cmds, 4);
+    assert.equal(r.samples.length, Math.floor(4 * r.sampleRate));
+    assert.ok(r.samples.some((x) => x != r.samples[0]));
+    // same input, same output
+    var r2 = _sound_williams.renderWilliamsSound(rom, cmds, 4, new Int16Array(r.samples.length));
+    assert.deepEqual(r2.samples, r.samples);
+    assert.equal(audio.encodeWAV(r.samples, r.sampleRate).length, 44 + r.samples.length*2);
+    console.log("sound_williams: " + r2.realtime.toFixed(1) + "x real time");
+  });
 
   it('Should run astrocade', () => {
     var platform = testPlatform('astrocade', 'cosmic.c.rom', 92, (platform, frameno) => {
@@ -251,6 +903,12 @@ describe('Platform Replay', () => {
       }
     });
   });
+  it('Should match the per-bit astrocade magic register', () => {
+    testAstrocadeMagic();
+  });
+  it('Should time astrocade magic writes', () => {
+    benchmarkAstrocadeMagic(1000000);
+  });
   it('Should run coleco', () => {
     var platform = testPlatform('coleco', 'shoot.c.rom', 92, (platform, frameno) => {
       if (frameno == 62) {
@@ -265,6 +923,18 @@ describe('Platform Replay', () => {
       }
     });
   });
+  it('Should render atari8 frames like the per-pixel GTIA', () => {
+    var frames = renderAtari8Frames('hello.a.rom', 30);
+    var bk = frames[29][0];
+    assert.ok(frames[29].some((rgba) => rgba != bk), "blank frame");
+    // captured from the renderer that called GTIA.clockPulse() once per pixel
+    var golden = [
+      "1e7e58da","4e8628da","1bae1ecd","3dcb70a3","980bcffc","23ca07b7","4ef0e110","44ffaef7",
+      "9c1444b5","08f057fc","f308f9e2","24d922a4","b6beb786","3afd269e","3fedf981","2099c236",
+      "0ca15c99","57722560","2ba3a341","1d0b840b","226e313a","02a6de40","27afca9b","f448d15d",
+      "7cfa83b8","a4c886e6","d891d088","0fc8c1a3","45ff9433","e01c92a5"];
+    assert.deepEqual(renderAtari8Scripted(golden.length), golden);
+  });
 /* TODO
   it('Should run atari8-5200', () => {
     var platform = testPlatform('atari8-5200', 'hello.a.rom', 92, (platform, frameno) => {
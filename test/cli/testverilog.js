@@ -5,6 +5,8 @@ var wtu = require('./workertestutils.js');
 
 var emu = require('gen/emu.js');
 var verilog = require('gen/platform/verilog.js');
+var waveform = require('gen/waveform.js');
+var nodemain = require('src/worker/nodemain.js');
 var VerilogPlatform = emu.PLATFORMS['verilog'];
 
 Object.assign(global, verilog); // copy global VL_* properties
@@ -139,6 +141,7 @@ describe('Verilog Worker', function() {
   testVerilator('test/cli/verilog/t_alw_splitord.v', ['BLKSEQ']);
 
   testVerilator('test/cli/verilog/t_array_compare.v');
+  testVerilator('test/cli/verilog/t_sig32.v');
 
   testVerilator('test/cli/verilog/t_math_arith.v', ['BLKSEQ']);
   //testVerilator('test/cli/verilog/t_math_div.v');
@@ -154,6 +157,74 @@ describe('Verilog Worker', function() {
   testVerilator('test/cli/verilog/t_clk_condflop.v', ['BLKSEQ']);
 
   testVerilator('presets/verilog/hvsync_generator.v');
+
+  it('should reuse translation after comment-only edit', function(done) {
+    var csource = ab2str(fs.readFileSync('presets/verilog/hvsync_generator.v'));
+    var hits = global.verilator_cache_hits;
+    global.postMessage = function(msg) {
+      assert.ok(msg.unchanged);
+      assert.equal(hits+1, global.verilator_cache_hits);
+      done();
+    };
+    global.onmessage({
+      data:{code:"// edited\n" + csource.replace(/\n/g, "  \n"), platform:'verilog', tool:'verilator', path:'main.v'}
+    });
+  });
+  it('should keep whitespace inside strings in the cache key', function() {
+    assert.notEqual(normalizeVerilogSource('$display("a  b");'), normalizeVerilogSource('$display("a b");'));
+    assert.equal(normalizeVerilogSource('x  =  1; // c\n\n\ty=2;'), 'x = 1;\ny=2;');
+  });
+  it('should round-trip a VCD capture', function(done) {
+    var csource = ab2str(fs.readFileSync('presets/verilog/clock_divider.v'));
+    global.postMessage = function(msg) {
+      var vcd = "";
+      var n = verilog.captureVCD(msg.output, 1000, function(s) { vcd += s; });
+      assert.equal(1000, n);
+      var reader = new waveform.VCDReader(function(ofs,len) { return vcd.substr(ofs,len); }, vcd.length);
+      var labels = reader.getSignalMetadata().map(function(m) { return m.label; });
+      var clk = reader.getSignalData(labels.indexOf('clk'), 500, 8);
+      var div2 = reader.getSignalData(labels.indexOf('clk_div2'), 500, 8);
+      assert.equal(8, clk.length);
+      for (var i=0; i<8; i++) {
+        assert.equal(clk[i] ^ clk[(i+1)&7], 1);
+        assert.equal(div2[i], div2[i^1]);
+        assert.notEqual(div2[i], div2[(i+2)&7]);
+      }
+      done();
+    };
+    global.onmessage({
+      data:{code:csource, platform:'verilog', tool:'verilator', path:'main.v'}
+    });
+  });
+  it('should decode a VCD with no signals', function() {
+    var vcd = "$timescale 1ns $end\n$enddefinitions $end\n#0\n#10\n";
+    var reader = new waveform.VCDReader(function(ofs,len) { return vcd.substr(ofs,len); }, vcd.length);
+    assert.equal(0, reader.getSignalMetadata().length);
+    reader.decodeWindow(0, 8);
+    assert.equal(0, reader.columns.length);
+  });
+  it('should write a VCD file from nodemain --vcd', function(done) {
+    var opts = nodemain.parseArgs(['--vcd', '/tmp/t_nodemain.vcd', '--cycles', '500', 'msgs.json']);
+    assert.equal('/tmp/t_nodemain.vcd', opts.vcdpath);
+    assert.equal(500, opts.ncycles);
+    assert.deepEqual(['msgs.json'], opts.files);
+    var csource = ab2str(fs.readFileSync('presets/verilog/clock_divider.v'));
+    global.postMessage = function(msg) {
+      var n = nodemain.writeVCD(verilog, msg.output, opts.vcdpath, opts.ncycles);
+      assert.equal(500, n);
+      var vcd = fs.readFileSync(opts.vcdpath, 'utf-8');
+      var reader = new waveform.VCDReader(function(ofs,len) { return vcd.substr(ofs,len); }, vcd.length);
+      var labels = reader.getSignalMetadata().map(function(m) { return m.label; });
+      assert.ok(labels.indexOf('clk_div2') >= 0);
+      var reset = reader.getSignalData(labels.indexOf('reset'), 0, 8);
+      assert.equal(1, reset[0]);
+      assert.equal(0, reset[7]);
+      done();
+    };
+    global.onmessage({
+      data:{code:csource, platform:'verilog', tool:'verilator', path:'main.v'}
+    });
+  });
   /*
   it('should compile verilog example', function(done) {
     var csource = ab2str(fs.readFileSync('presets/verilog/hvsync_generator.v'));
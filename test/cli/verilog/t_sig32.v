@@ -0,0 +1,35 @@
+// 32-bit signals with bit 31 set are unsigned in compares and shifts,
+// though they're stored in an Int32Array
+
+module t (/*AUTOARG*/
+   // Inputs
+   clk
+   );
+   input clk;
+
+   reg [31:0] r;
+   reg [31:0] s;
+   reg [3:0] cyc;
+   initial cyc = 0;
+
+   always @ (posedge clk) begin
+      cyc <= cyc + 1;
+      if (cyc == 1) begin
+         r <= 32'hffffffff;
+         s <= 32'h80000001;
+      end
+      if (cyc == 3) begin
+         if (r != 32'hffffffff) $stop;
+         if (s != 32'h80000001) $stop;
+         if (r == s) $stop;
+         if (!s[31]) $stop;
+         if ((r & 32'h80000000) != 32'h80000000) $stop;
+         if ((s >> 31) != 32'h1) $stop;
+         if ((r >> 4) != 32'h0fffffff) $stop;
+         if (!(s > 32'h7fffffff)) $stop;
+         if (!(r >= s)) $stop;
+         if (s < 32'h1) $stop;
+         $finish;
+      end
+   end
+endmodule